@@ -0,0 +1,212 @@
+/*
+AssetLoader class
+- parallel loading of the assets of the scene: the CPU part of each asset (parsing of the model files, decoding of the images with stb_image or reading of the texture cache, ...)
+  runs on a set of worker threads, while the thread which owns the GL context creates the OpenGL buffers and textures
+- each job has two steps: Work, called by a worker, prepares the data in memory without OpenGL calls, and Upload, called by the GL thread,
+  sends them to the GPU. The workers push the finished jobs in a ready queue, which is drained by the GL thread (Finish)
+  while the other jobs are still running
+- LoadModel, LoadTexture and LoadCubemap add the jobs for the assets used by the application (the faces of a cubemap are decoded by different jobs);
+  any other asset (e.g., the glyphs of a font) can be added with Add
+
+The jobs are added on the GL thread, and then Finish runs all of them: the startup time is close to the time of the largest single asset
+(plus the uploads, which are done in the order in which the jobs finish).
+The destinations of the jobs (Model instances, texture ids) must stay valid until Finish returns.
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <functional>
+
+#include <utils/model_v2.h>
+#include <utils/thread_pool.h>
+
+/////////////////// ASSET LOADER class ///////////////////////
+class AssetLoader
+{
+public:
+    // step of a job (Work on a worker, Upload on the GL thread)
+    typedef function<void()> Task;
+
+    //////////////////////////////////////////
+    // Constructor (number of worker threads)
+    AssetLoader(int numThreads = ThreadPool::HardwareThreads())
+    {
+        this->numThreads = numThreads > 0 ? numThreads : 1;
+        this->nextJob = 0;
+    }
+
+    //////////////////////////////////////////
+
+    // a generic job is added: work prepares the data (it must not call OpenGL), upload sends them to the GPU
+    void Add(const Task& work, const Task& upload)
+    {
+        Job job = {work, upload};
+        this->jobs.push_back(job);
+    }
+
+    // the model file is parsed (see Model::Parse), and the meshes are uploaded in the given (empty) model
+    void LoadModel(const string& path, Model* model)
+    {
+        ModelData* data = new ModelData();
+        this->Add([path, data]()
+        {
+            Model::Parse(path, *data);
+        },
+        [model, data]()
+        {
+            model->Upload(*data);
+            delete data;
+        });
+    }
+
+    // 2D texture with mipmaps (the number of channels of the file is kept). The texture id is written in id
+    void LoadTexture(const string& path, GLuint* id)
+    {
+        ImageData* image = new ImageData();
+        this->Add([path, image]()
+        {
+            TextureCache::Load(path, *image);
+        },
+        [id, image]()
+        {
+            *id = TextureFromImage(*image);
+            delete image;
+        });
+    }
+
+    // cubemap texture (faces in the order +X, -X, +Y, -Y, +Z, -Z). Each face is decoded by a different job: the texture is created
+    // by the upload of the first finished face, and its id is written in id
+    void LoadCubemap(const vector<string>& faces, GLuint* id)
+    {
+        *id = 0;
+        for (GLuint i = 0; i < faces.size(); i++)
+        {
+            ImageData* image = new ImageData();
+            string path = faces[i];
+            this->Add([path, image]()
+            {
+                TextureCache::Load(path, *image, false);
+            },
+            [id, image, i]()
+            {
+                if (*id == 0)
+                {
+                    glGenTextures(1, id);
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, *id);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+                }
+                glBindTexture(GL_TEXTURE_CUBE_MAP, *id);
+                if (!image->Levels.empty())
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, image->Width, image->Height, 0, GL_RGB, GL_UNSIGNED_BYTE, &image->Levels[0][0]);
+                glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                delete image;
+            });
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // all the added jobs are run: the workers are started, and the calling thread (which must own the GL context) uploads the data of each job
+    // as soon as it is ready. It returns when all the jobs have been uploaded, and the list of jobs is emptied
+    int Finish()
+    {
+        int count = this->jobs.size();
+        if (count == 0)
+            return 0;
+        this->nextJob = 0;
+        this->ready.clear();
+        this->ready.reserve(count);
+
+        int n = count < this->numThreads ? count : this->numThreads;
+#ifdef _WIN32
+        vector<HANDLE> workers(n);
+        for (int i = 0; i < n; i++)
+            workers[i] = CreateThread(NULL, 0, AssetLoader::workerMain, this, 0, NULL);
+#else
+        vector<pthread_t> workers(n);
+        for (int i = 0; i < n; i++)
+            pthread_create(&workers[i], NULL, AssetLoader::workerMain, this);
+#endif
+
+        // the jobs are uploaded in the order in which they finish
+        for (int i = 0; i < count; i++)
+        {
+            this->readySignal.Wait();
+            this->readyMutex.Lock();
+            int job = this->ready[i];
+            this->readyMutex.Unlock();
+            this->jobs[job].Upload();
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+#ifdef _WIN32
+            WaitForSingleObject(workers[i], INFINITE);
+            CloseHandle(workers[i]);
+#else
+            pthread_join(workers[i], NULL);
+#endif
+        }
+        this->jobs.clear();
+        return count;
+    }
+
+private:
+    struct Job
+    {
+        Task Work;
+        Task Upload;
+    };
+
+    int numThreads;
+    vector<Job> jobs;
+    // next job to be taken by a worker
+    volatile int nextJob;
+    // indices of the finished jobs, in the order in which they finished (read by the GL thread)
+    vector<int> ready;
+    Mutex readyMutex;
+    Semaphore readySignal;
+
+    //////////////////////////////////////////
+
+    // jobs are taken until all of them have been assigned
+    void workerLoop()
+    {
+        int job;
+        while ((job = __sync_fetch_and_add(&this->nextJob, 1)) < (int)this->jobs.size())
+        {
+            this->jobs[job].Work();
+            this->readyMutex.Lock();
+            this->ready.push_back(job);
+            this->readyMutex.Unlock();
+            this->readySignal.Signal();
+        }
+    }
+
+#ifdef _WIN32
+    static DWORD WINAPI workerMain(LPVOID param)
+    {
+        ((AssetLoader*)param)->workerLoop();
+        return 0;
+    }
+#else
+    static void* workerMain(void* param)
+    {
+        ((AssetLoader*)param)->workerLoop();
+        return NULL;
+    }
+#endif
+
+    // copy is not allowed
+    AssetLoader(const AssetLoader&);
+    AssetLoader& operator=(const AssetLoader&);
+};
@@ -0,0 +1,86 @@
+/*
+AssetRegistry class
+- registry of the models loaded from file: each file is loaded only once (with its GPU buffers, textures and spatial hash), and the same
+  Model instance is returned for the following requests
+- the objects of the scene are instances of the loaded models (see Model(Model* asset, int type)): they share vertices and indices of the asset,
+  and an instance gets its own copy of the vertices only when it is deformed for the first time (copy on write)
+
+Models can also be loaded in parallel with an AssetLoader (see utils/asset_loader.h): the registry returns an empty model, which is filled
+when the loader uploads it, so the instances must be created after AssetLoader::Finish.
+
+The registry owns the loaded models: they are deallocated by Clear (or by the destructor), which must be called after the instances are deleted.
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <map>
+
+#include <utils/model_v2.h>
+#include <utils/asset_loader.h>
+
+/////////////////// ASSET REGISTRY class ///////////////////////
+class AssetRegistry
+{
+public:
+    //////////////////////////////////////////
+    // Constructor
+    AssetRegistry() {}
+
+    // destructor: the loaded models are deallocated
+    ~AssetRegistry()
+    {
+        this->Clear();
+    }
+
+    //////////////////////////////////////////
+
+    // model loaded from the file (it is loaded only the first time)
+    Model* Load(const string& path)
+    {
+        map<string, Model*>::iterator it = this->assets.find(path);
+        if (it != this->assets.end())
+            return it->second;
+        Model* asset = new Model(path);
+        this->assets[path] = asset;
+        return asset;
+    }
+
+    // same as above, but the model is loaded by the loader (it is empty until AssetLoader::Finish)
+    Model* Load(const string& path, AssetLoader& loader)
+    {
+        map<string, Model*>::iterator it = this->assets.find(path);
+        if (it != this->assets.end())
+            return it->second;
+        Model* asset = new Model();
+        loader.LoadModel(path, asset);
+        this->assets[path] = asset;
+        return asset;
+    }
+
+    // number of loaded models
+    int Size() const
+    {
+        return this->assets.size();
+    }
+
+    //////////////////////////////////////////
+
+    // all the loaded models are deallocated
+    void Clear()
+    {
+        for (map<string, Model*>::iterator it = this->assets.begin(); it != this->assets.end(); ++it)
+            delete it->second;
+        this->assets.clear();
+    }
+
+private:
+    map<string, Model*> assets;
+
+    // copy is not allowed (the models would be deallocated twice)
+    AssetRegistry(const AssetRegistry&);
+    AssetRegistry& operator=(const AssetRegistry&);
+};
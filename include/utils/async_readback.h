@@ -0,0 +1,187 @@
+/*
+AsyncReadback class
+- asynchronous copy of data from a GPU buffer to the CPU, without stalling the pipeline
+- each request copies the data in a staging buffer (glCopyBufferSubData, executed by the GPU after the commands already issued, e.g. transform feedback),
+  and puts a fence (glFenceSync) after the copy
+- Poll (called once per frame) checks the fences without waiting: when the GPU has finished a copy, the staging buffer is mapped,
+  and the callback of the request is called with the data (usually one or two frames later)
+
+The staging buffers are a small ring: if all of them are busy, the oldest request is completed (waiting for the GPU) before issuing the new one.
+Requests are completed in the same order they are issued.
+The callbacks can be run inside a critical section (see SetCallbackLock): the waits for the GPU and the mapping of the staging buffers are done
+outside of it, so another thread (e.g., the physics thread, which reads the vertices of the models) is blocked only while the data are applied. If the data can not be read (the staging buffer can not be mapped, or the GPU does not finish the copy
+within ASYNC_READBACK_TIMEOUT), the callback is called anyway, with NULL data, so that the caller can release what it was keeping for the request.
+
+N.B.) glCopyBufferSubData and sync objects are core features of OpenGL 3.1 and 3.2
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <functional>
+#include <iostream>
+
+#include <glad/glad.h>
+
+// maximum wait (in nanoseconds) for a copy, when a request must be completed (1 second)
+const GLuint64 ASYNC_READBACK_TIMEOUT = 1000000000;
+
+/////////////////// ASYNC READBACK class ///////////////////////
+class AsyncReadback
+{
+public:
+    // function called when data are available: it receives the pointer to the data and their size (in bytes).
+    // The pointer is valid only during the call, and it is NULL if the data could not be read
+    typedef function<void(const void*, GLsizeiptr)> Callback;
+    // function called before and after each callback
+    typedef function<void()> Hook;
+
+    //////////////////////////////////////////
+    // Constructor (number of staging buffers in the ring)
+    AsyncReadback(GLuint ringSize = 4)
+    {
+        this->slots.resize(ringSize);
+        this->first = 0;
+        this->pending = 0;
+    }
+
+    //////////////////////////////////////////
+
+    // a copy of "size" bytes of the buffer, starting from "offset", is requested. The callback is called by Poll (or Flush) when data are on the CPU
+    void Request(GLuint buffer, GLintptr offset, GLsizeiptr size, Callback callback)
+    {
+        if (size <= 0)
+            return;
+        // no free staging buffer: we must wait for the oldest request
+        if (this->pending == this->slots.size())
+            this->complete(ASYNC_READBACK_TIMEOUT, true);
+
+        Slot& slot = this->slots[(this->first + this->pending) % this->slots.size()];
+        if (slot.buffer == 0)
+            glGenBuffers(1, &slot.buffer);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+        // the staging buffer is enlarged only if needed
+        if (size > slot.capacity)
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_READ);
+            slot.capacity = size;
+        }
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.size = size;
+        slot.callback = callback;
+        this->pending++;
+    }
+
+    // the callbacks of the completed requests are called, without waiting for the GPU. It returns the number of completed requests
+    int Poll()
+    {
+        int completed = 0;
+        while (this->pending > 0 && this->complete(0))
+            completed++;
+        return completed;
+    }
+
+    // all the pending requests are completed, waiting for the GPU if needed
+    void Flush()
+    {
+        while (this->pending > 0)
+            this->complete(ASYNC_READBACK_TIMEOUT, true);
+    }
+
+    // each callback is called between lock and unlock (e.g., to lock the physics world while the vertices of the models are changed)
+    void SetCallbackLock(const Hook& lock, const Hook& unlock)
+    {
+        this->lock = lock;
+        this->unlock = unlock;
+    }
+
+    GLuint Pending() const
+    {
+        return this->pending;
+    }
+
+    //////////////////////////////////////////
+
+    // buffers are deallocated when application ends
+    void Delete()
+    {
+        this->Flush();
+        for (GLuint i = 0; i < this->slots.size(); i++)
+        {
+            if (this->slots[i].buffer != 0)
+                glDeleteBuffers(1, &this->slots[i].buffer);
+            this->slots[i] = Slot();
+        }
+    }
+
+private:
+    // data structure for a staging buffer of the ring
+    struct Slot {
+        GLuint buffer;
+        GLsizeiptr capacity;
+        // data of the pending request
+        GLsync fence;
+        GLsizeiptr size;
+        Callback callback;
+
+        Slot() : buffer(0), capacity(0), fence(0), size(0) {}
+    };
+
+    vector<Slot> slots;
+    // oldest pending request, and number of pending requests
+    GLuint first;
+    GLuint pending;
+    // critical section of the callbacks (empty functions: no lock)
+    Hook lock;
+    Hook unlock;
+
+    //////////////////////////////////////////
+
+    // the oldest request is completed if the GPU has finished the copy within the timeout (in nanoseconds). It returns true if completed.
+    // If force is true, the request is completed even if the copy is not finished within the timeout (its data are not read)
+    bool complete(GLuint64 timeout, bool force = false)
+    {
+        Slot& slot = this->slots[this->first];
+        GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (status == GL_TIMEOUT_EXPIRED && !force)
+            return false;
+        if (status == GL_TIMEOUT_EXPIRED)
+            cout << "ERROR::ASYNC_READBACK:: timeout expired while waiting for the copy" << endl;
+        if (status == GL_WAIT_FAILED)
+            cout << "ERROR::ASYNC_READBACK:: glClientWaitSync failed" << endl;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+
+        void* data = NULL;
+        glBindBuffer(GL_COPY_READ_BUFFER, slot.buffer);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            data = glMapBufferRange(GL_COPY_READ_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+            if (data == NULL)
+                cout << "ERROR::ASYNC_READBACK:: staging buffer can not be mapped" << endl;
+        }
+        // the callback is always called, also without data, so that the caller can release the request
+        if (this->lock)
+            this->lock();
+        slot.callback(data, slot.size);
+        if (this->unlock)
+            this->unlock();
+        if (data != NULL)
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        slot.callback = Callback();
+        this->first = (this->first + 1) % this->slots.size();
+        this->pending--;
+        return true;
+    }
+};
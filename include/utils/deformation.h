@@ -0,0 +1,312 @@
+/*
+DeformationEngine class
+- CPU implementation of the impact model used by the transform feedback pass (work/FeeFeed/shaders/feedback.VERT)
+- given an impact (hit point and direction, in world coordinates) and the model matrix of the hit object, it moves the positions and normals of the vertices inside the range of the impact
+
+The operations are performed in the same order (and with the same single precision) of the vertex shader, so the results of the CPU and GPU paths can be compared vertex by vertex.
+No OpenGL call is performed: after the deformation, the moved vertices are marked as dirty, and the caller decides when to upload them on the GPU (using Mesh::UpdateMesh).
+Meshes are deformed using their SoA copy of positions and normals (Mesh::streams) with a SIMD kernel, which gives the same results of the scalar implementation.
+
+N.B.) the header uses the Vertex and Mesh data structures, so it must be included after the Mesh class (e.g., after utils/model_v2.h)
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+// data structure for an impact
+struct Impact {
+    // hit point in world coordinates
+    glm::vec3 Point;
+    // direction of the hitting object in world coordinates
+    glm::vec3 Direction;
+};
+
+/////////////////// DEFORMATION ENGINE class ///////////////////////
+class DeformationEngine
+{
+public:
+    // parameters of the impact model
+    // - range: maximum distance (in world coordinates) between the hit point and a vertex to be moved
+    // - power: the displacement is power/distance ...
+    // - max_magnitude: ... clamped to this value
+    float range;
+    float power;
+    float max_magnitude;
+
+    //////////////////////////////////////////
+    // Constructor (default values are the ones used in feedback.VERT)
+    DeformationEngine(float range = 0.5f, float power = 0.05f, float max_magnitude = 0.3f)
+    {
+        this->range = range;
+        this->power = power;
+        this->max_magnitude = max_magnitude;
+    }
+
+    //////////////////////////////////////////
+
+    // deformation of a single vertex (position and normal are in model coordinates).
+    // invModel must be the inverse of model. It returns true if the vertex has been moved.
+    bool DeformVertex(glm::vec3& position, glm::vec3& normal, const glm::mat4& model, const glm::mat4& invModel, const Impact& impact) const
+    {
+        glm::vec4 fragPos = model * glm::vec4(position, 1.0f);
+
+        float distance = getDistance(impact.Point, glm::vec3(fragPos));
+
+        if (!(distance < this->range))
+            return false;
+
+        float magnitude = this->power / distance;
+        magnitude = glm::min(magnitude, this->max_magnitude);
+        fragPos = explode(fragPos, impact.Direction, -normal, magnitude, normal);
+        fragPos = invModel * fragPos;
+
+        position = glm::vec3(fragPos);
+        return true;
+    }
+
+    // deformation of an array of vertices. It returns the number of vertices that have been moved.
+    int Deform(vector<Vertex>& vertices, const glm::mat4& model, const Impact& impact) const
+    {
+        glm::mat4 invModel = glm::inverse(model);
+        int moved = 0;
+        for (GLuint i = 0; i < vertices.size(); i++)
+        {
+            if (this->DeformVertex(vertices[i].Position, vertices[i].Normal, model, invModel, impact))
+                moved++;
+        }
+        return moved;
+    }
+
+    // deformation of the SoA copy of positions and normals (see utils/vertex_streams.h), processing SIMD_WIDTH vertices at a time.
+    // The indices of the moved vertices are added to "moved". It returns the number of moved vertices.
+    int DeformStreams(VertexStreams& s, const glm::mat4& model, const Impact& impact, vector<GLuint>& moved) const
+    {
+        glm::mat4 invModel = glm::inverse(model);
+        GLuint n = s.Size();
+        GLuint i = 0;
+        moved.clear();
+
+#if SIMD_WIDTH > 1
+        SimdImpact k;
+        this->setupSimd(k, model, invModel, impact);
+
+        for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+        {
+            simd_float p[3] = {simd_load(&s.PosX[i]), simd_load(&s.PosY[i]), simd_load(&s.PosZ[i])};
+            simd_float nrm[3] = {simd_load(&s.NormX[i]), simd_load(&s.NormY[i]), simd_load(&s.NormZ[i])};
+            int mask = deformBlock(k, p, nrm);
+            // most of the blocks are far from the impact: we skip them with a single test
+            if (mask == 0)
+                continue;
+
+            simd_store(&s.PosX[i], p[0]); simd_store(&s.PosY[i], p[1]); simd_store(&s.PosZ[i], p[2]);
+            simd_store(&s.NormX[i], nrm[0]); simd_store(&s.NormY[i], nrm[1]); simd_store(&s.NormZ[i], nrm[2]);
+
+            for (int lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                if (mask & 1)
+                    moved.push_back(i + lane);
+            }
+        }
+#endif
+        // scalar fallback (and remaining vertices)
+        for (; i < n; i++)
+            this->deformStreamVertex(s, i, model, invModel, impact, moved);
+        return moved.size();
+    }
+
+    // same as above, but only the vertices with the given indices are considered (e.g., the ones found by a SpatialHash query).
+    // Their data are gathered in SIMD registers, so the cost depends on the number of indices and not on the size of the mesh
+    int DeformStreams(VertexStreams& s, const vector<GLuint>& indices, const glm::mat4& model, const Impact& impact, vector<GLuint>& moved) const
+    {
+        glm::mat4 invModel = glm::inverse(model);
+        GLuint n = indices.size();
+        GLuint i = 0;
+        moved.clear();
+
+#if SIMD_WIDTH > 1
+        SimdImpact k;
+        this->setupSimd(k, model, invModel, impact);
+
+        for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+        {
+            const GLuint* idx = &indices[i];
+            simd_float p[3] = {simd_gather(&s.PosX[0], idx), simd_gather(&s.PosY[0], idx), simd_gather(&s.PosZ[0], idx)};
+            simd_float nrm[3] = {simd_gather(&s.NormX[0], idx), simd_gather(&s.NormY[0], idx), simd_gather(&s.NormZ[0], idx)};
+            int mask = deformBlock(k, p, nrm);
+            if (mask == 0)
+                continue;
+
+            // there is no scatter instruction: moved lanes are written one at a time
+            float out[6][SIMD_WIDTH];
+            for (int c = 0; c < 3; c++)
+            {
+                simd_store(out[c], p[c]);
+                simd_store(out[c + 3], nrm[c]);
+            }
+            for (int lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                if (mask & 1)
+                {
+                    s.Set(idx[lane], glm::vec3(out[0][lane], out[1][lane], out[2][lane]), glm::vec3(out[3][lane], out[4][lane], out[5][lane]));
+                    moved.push_back(idx[lane]);
+                }
+            }
+        }
+#endif
+        // scalar fallback (and remaining vertices)
+        for (; i < n; i++)
+            this->deformStreamVertex(s, indices[i], model, invModel, impact, moved);
+        return moved.size();
+    }
+
+    // deformation of the CPU copy of the vertices of a mesh (no data are sent to the GPU).
+    // The SoA copy is deformed by the SIMD kernel, and then only the moved vertices are copied back in mesh.vertices
+    int Deform(Mesh& mesh, const glm::mat4& model, const Impact& impact)
+    {
+        int n = this->DeformStreams(mesh.streams, model, impact, this->moved);
+        for (int k = 0; k < n; k++)
+        {
+            mesh.streams.Store(mesh.vertices, this->moved[k]);
+            mesh.MarkDirty(this->moved[k]);
+        }
+        return n;
+    }
+
+    // same as above, considering only the vertices with the given indices
+    int Deform(Mesh& mesh, const vector<GLuint>& indices, const glm::mat4& model, const Impact& impact)
+    {
+        int n = this->DeformStreams(mesh.streams, indices, model, impact, this->moved);
+        for (int k = 0; k < n; k++)
+        {
+            mesh.streams.Store(mesh.vertices, this->moved[k]);
+            mesh.MarkDirty(this->moved[k]);
+        }
+        return n;
+    }
+
+    // deformation of all the meshes of a model
+    int Deform(vector<Mesh>& meshes, const glm::mat4& model, const Impact& impact)
+    {
+        int moved = 0;
+        for (GLuint i = 0; i < meshes.size(); i++)
+            moved += this->Deform(meshes[i], model, impact);
+        return moved;
+    }
+
+    // indices of the vertices moved by the last call of Deform
+    const vector<GLuint>& Moved() const
+    {
+        return this->moved;
+    }
+
+private:
+    // indices of the moved vertices (kept as member to avoid allocations at each impact)
+    vector<GLuint> moved;
+
+#if SIMD_WIDTH > 1
+    // impact data and matrices, replicated in all the lanes of SIMD registers
+    struct SimdImpact {
+        simd_float m[4][4], im[4][4];
+        simd_float hit[3], dir[3];
+        simd_float range, power, max_magnitude, one;
+    };
+
+    void setupSimd(SimdImpact& k, const glm::mat4& model, const glm::mat4& invModel, const Impact& impact) const
+    {
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+            {
+                k.m[c][r] = simd_set1(model[c][r]);
+                k.im[c][r] = simd_set1(invModel[c][r]);
+            }
+        for (int c = 0; c < 3; c++)
+        {
+            k.hit[c] = simd_set1(impact.Point[c]);
+            k.dir[c] = simd_set1(impact.Direction[c]);
+        }
+        k.range = simd_set1(this->range);
+        k.power = simd_set1(this->power);
+        k.max_magnitude = simd_set1(this->max_magnitude);
+        k.one = simd_set1(1.0f);
+    }
+
+    // deformation of SIMD_WIDTH vertices (same operations of DeformVertex, in the same order).
+    // Positions and normals are changed only in the lanes inside the range. It returns the mask of the moved lanes.
+    static int deformBlock(const SimdImpact& k, simd_float p[3], simd_float n[3])
+    {
+        // FragPos = model * vec4(position, 1.0) (same order of operations of glm and of the shader)
+        simd_float f[4];
+        for (int r = 0; r < 4; r++)
+            f[r] = simd_add(simd_add(simd_mul(k.m[0][r], p[0]), simd_mul(k.m[1][r], p[1])),
+                            simd_add(simd_mul(k.m[2][r], p[2]), k.m[3][r]));
+
+        simd_float dx = simd_sub(k.hit[0], f[0]), dy = simd_sub(k.hit[1], f[1]), dz = simd_sub(k.hit[2], f[2]);
+        simd_float distance = simd_sqrt(simd_add(simd_add(simd_mul(dx, dx), simd_mul(dy, dy)), simd_mul(dz, dz)));
+        simd_float inRange = simd_cmplt(distance, k.range);
+        int mask = simd_movemask(inRange);
+        if (mask == 0)
+            return 0;
+
+        simd_float magnitude = simd_min(simd_div(k.power, distance), k.max_magnitude);
+        simd_float o[3];
+        for (int c = 0; c < 3; c++)
+            o[c] = simd_mul(k.dir[c], magnitude);
+
+        // Normal = -normalize(-normal + direction)
+        simd_float v[3];
+        for (int c = 0; c < 3; c++)
+            v[c] = simd_add(simd_neg(n[c]), o[c]);
+        simd_float inv = simd_div(k.one, simd_sqrt(simd_add(simd_add(simd_mul(v[0], v[0]), simd_mul(v[1], v[1])), simd_mul(v[2], v[2]))));
+
+        // FragPos = inverse(model) * (FragPos + vec4(direction, 0.0))
+        simd_float e[4] = {simd_add(f[0], o[0]), simd_add(f[1], o[1]), simd_add(f[2], o[2]), f[3]};
+        for (int r = 0; r < 3; r++)
+        {
+            simd_float q = simd_add(simd_add(simd_mul(k.im[0][r], e[0]), simd_mul(k.im[1][r], e[1])),
+                                    simd_add(simd_mul(k.im[2][r], e[2]), simd_mul(k.im[3][r], e[3])));
+            // only the vertices inside the range are changed
+            p[r] = simd_select(inRange, q, p[r]);
+            n[r] = simd_select(inRange, simd_neg(simd_mul(v[r], inv)), n[r]);
+        }
+        return mask;
+    }
+#endif
+
+    // scalar deformation of the i-th vertex of the SoA copy
+    void deformStreamVertex(VertexStreams& s, GLuint i, const glm::mat4& model, const glm::mat4& invModel, const Impact& impact, vector<GLuint>& moved) const
+    {
+        glm::vec3 position = s.Position(i);
+        glm::vec3 normal = s.Normal(i);
+        if (this->DeformVertex(position, normal, model, invModel, impact))
+        {
+            s.Set(i, position, normal);
+            moved.push_back(i);
+        }
+    }
+
+    //////////////////////////////////////////
+    // same implementation of getDistance in the shader (sum of explicit squares, in single precision)
+    static float getDistance(const glm::vec3& point1, const glm::vec3& point2)
+    {
+        float dx = point1.x - point2.x;
+        float dy = point1.y - point2.y;
+        float dz = point1.z - point2.z;
+        return sqrtf(dx*dx + dy*dy + dz*dz);
+    }
+
+    // same implementation of explode in the shader: the vertex is moved along the direction, and the normal is recalculated
+    static glm::vec4 explode(const glm::vec4& position, glm::vec3 direction, const glm::vec3& normal, float magnitude, glm::vec3& newNormal)
+    {
+        direction = direction * magnitude;
+        newNormal = -glm::normalize(normal + direction);
+        return position + glm::vec4(direction, 0.0f);
+    }
+};
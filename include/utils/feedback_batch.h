@@ -0,0 +1,311 @@
+/*
+FeedbackBatch class
+- transform feedback deformation of all the models hit in a frame, with a single draw call
+- for each impact (Add), the vertices that can be reached (found with the spatial hash of the model) are appended to a shared input buffer,
+  together with the index of their impact; matrices, hit point and direction of each impact are stored in a buffer texture
+- Dispatch uploads the data, runs the feedback shader (shaders/feedbackBatch.VERT) once over the whole buffer, and requests an asynchronous readback
+  of the results: each model receives its sub-range when data are available (Model::UpdateImpactVertices)
+
+The buffers are allocated once, and enlarged only when needed, so no buffer is (re)allocated and no attribute is specified at each impact.
+The data to be uploaded are packed in the frame arena, and the ranges of the batches are reused, so the heap is not used in the frame loop.
+A model can be added only once to a batch: the second impact must start from the results of the first, so the batch must be dispatched before (see Contains).
+The same happens when the batch is full (see Full).
+
+N.B.) the header uses the Model, ShaderFee, AsyncReadback and FrameArena classes, so it must be included after utils/model_v2.h and utils/shader_fee.h
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <utils/frame_arena.h>
+
+// number of RGBA texels for the data of an impact in the buffer texture (model matrix, inverse model matrix, hit point, hit direction)
+#define IMPACT_TEXELS 10
+// number of batches that can be filled or waiting for their results at the same time
+#define BATCH_RING 4
+
+/////////////////// FEEDBACK BATCH class ///////////////////////
+class FeedbackBatch
+{
+public:
+    //////////////////////////////////////////
+    // Constructor (maximum number of impacts in a batch)
+    FeedbackBatch(GLuint maxImpacts = 32)
+    {
+        this->maxImpacts = maxImpacts;
+        this->VAO = 0;
+        this->vertexCapacity = 0;
+        this->impactCapacity = 0;
+        this->batches.resize(BATCH_RING);
+        this->current = 0;
+        this->numVertices = 0;
+    }
+
+    //////////////////////////////////////////
+
+    // the vertices of the model that can be moved by the impact (with the given range) are added to the batch.
+    // The batch must not be full. It returns the number of added vertices
+    int Add(Model& object, const glm::mat4& model, const Impact& impact, float range)
+    {
+        int dim = object.FindImpactVertices(model, impact.Point, range);
+        if (dim == 0)
+            return 0;
+
+        // the ranges (and their vectors of indices) are reused, so memory is allocated only for the first batches
+        Batch& batch = this->batches[this->current];
+        if (batch.numRanges == batch.ranges.size())
+            batch.ranges.push_back(Range());
+        Range& r = batch.ranges[batch.numRanges++];
+        r.object = &object;
+        r.first = this->numVertices;
+        r.indices = object.impactVertices;
+        r.model = model;
+        r.impact = impact;
+        this->numVertices += dim;
+        return dim;
+    }
+
+    // true if the model has already been added to the batch
+    bool Contains(const Model* object) const
+    {
+        const Batch& batch = this->batches[this->current];
+        for (GLuint r = 0; r < batch.numRanges; r++)
+        {
+            if (batch.ranges[r].object == object)
+                return true;
+        }
+        return false;
+    }
+
+    bool Full() const
+    {
+        return this->batches[this->current].numRanges >= this->maxImpacts;
+    }
+
+    bool Empty() const
+    {
+        return this->batches[this->current].numRanges == 0;
+    }
+
+    // all the vertices of the batch are deformed with a single transform feedback pass, and the results are read asynchronously.
+    // The data sent to the GPU are packed in memory of the frame arena (see utils/frame_arena.h). It returns the number of processed vertices
+    int Dispatch(ShaderFee& shader, const DeformationEngine& engine, AsyncReadback& readback)
+    {
+        Batch& batch = this->batches[this->current];
+        if (batch.numRanges == 0)
+            return 0;
+        if (this->VAO == 0)
+            this->setupBatch();
+
+        GLuint dim = this->numVertices;
+        this->reserve(dim, batch.numRanges);
+
+        // data of the batch: interleaved (position, normal) pairs, index of the impact of each vertex, and impact data
+        FrameArena& arena = FrameArena::Frame();
+        glm::vec3* vertices = arena.Alloc<glm::vec3>(dim * 2);
+        GLint* impactIndices = arena.Alloc<GLint>(dim);
+        glm::vec4* impacts = arena.Alloc<glm::vec4>(batch.numRanges * IMPACT_TEXELS);
+        for (GLuint r = 0; r < batch.numRanges; r++)
+        {
+            const Range& range = batch.ranges[r];
+            GLuint v = range.first;
+            for (GLuint i = 0; i < range.indices.size(); i++)
+            {
+                for (GLuint k = 0; k < range.indices[i].size(); k++, v++)
+                {
+                    GLuint j = range.indices[i][k];
+                    vertices[v*2] = range.object->Meshes()[i].streams.Position(j);
+                    vertices[v*2 + 1] = range.object->Meshes()[i].streams.Normal(j);
+                    impactIndices[v] = r;
+                }
+            }
+
+            glm::vec4* texels = impacts + r * IMPACT_TEXELS;
+            glm::mat4 invModel = glm::inverse(range.model);
+            for (int c = 0; c < 4; c++)
+            {
+                texels[c] = range.model[c];
+                texels[4 + c] = invModel[c];
+            }
+            texels[8] = glm::vec4(range.impact.Point, 1.0f);
+            texels[9] = glm::vec4(range.impact.Direction, 0.0f);
+        }
+
+        // data upload (the buffers are not reallocated)
+        glBindBuffer(GL_ARRAY_BUFFER, this->inputVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, dim * 2 * sizeof(glm::vec3), vertices);
+        glBindBuffer(GL_ARRAY_BUFFER, this->indexVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, dim * sizeof(GLint), impactIndices);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->impactBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, batch.numRanges * IMPACT_TEXELS * sizeof(glm::vec4), impacts);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        shader.use();
+        shader.setFloat("range", engine.range);
+        shader.setFloat("power", engine.power);
+        shader.setFloat("max_magnitude", engine.max_magnitude);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, this->impactTexture);
+        shader.setInt("impacts", 0);
+
+        glBindVertexArray(this->VAO);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, this->outputVBO);
+        glEnable(GL_RASTERIZER_DISCARD);
+        // one point for each vertex of all the impacts
+        glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, dim);
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+        // a single readback for the whole batch: each model receives its sub-range
+        for (GLuint r = 0; r < batch.numRanges; r++)
+            batch.ranges[r].object->pendingReadbacks++;
+        batch.reading = true;
+        GLuint index = this->current;
+        readback.Request(this->outputVBO, 0, dim * 2 * sizeof(glm::vec3), [this, index](const void* data, GLsizeiptr size)
+        {
+            this->apply(index, (const glm::vec3*)data);
+        });
+
+        // the next batch is filled while this one is being read: if it is still being read (too many batches in flight), we wait for it
+        this->current = (this->current + 1) % this->batches.size();
+        this->numVertices = 0;
+        if (this->batches[this->current].reading)
+            readback.Flush();
+        return dim;
+    }
+
+    //////////////////////////////////////////
+
+    // buffers are deallocated when application ends
+    void Delete()
+    {
+        if (this->VAO == 0)
+            return;
+        glDeleteVertexArrays(1, &this->VAO);
+        glDeleteBuffers(1, &this->inputVBO);
+        glDeleteBuffers(1, &this->indexVBO);
+        glDeleteBuffers(1, &this->outputVBO);
+        glDeleteBuffers(1, &this->impactBuffer);
+        glDeleteTextures(1, &this->impactTexture);
+        this->VAO = 0;
+    }
+
+private:
+    // sub-range of the batch with the vertices of a model
+    struct Range {
+        Model* object;
+        // index of the first vertex in the batch
+        GLuint first;
+        // for each mesh, the indices of the vertices (result of Model::FindImpactVertices)
+        vector<vector<GLuint> > indices;
+        // model matrix and impact
+        glm::mat4 model;
+        Impact impact;
+    };
+
+    // ranges of a batch (only the first numRanges are used), and flag for a batch whose results are being read
+    struct Batch {
+        vector<Range> ranges;
+        GLuint numRanges;
+        bool reading;
+
+        Batch() : numRanges(0), reading(false) {}
+    };
+
+    GLuint maxImpacts;
+    // ring of batches: the current one is being filled, the others can be waiting for their results
+    vector<Batch> batches;
+    GLuint current;
+    // number of vertices of the current batch
+    GLuint numVertices;
+
+    // VAO, input buffers (vertices and impact indices), transform feedback buffer, buffer texture with the impacts
+    GLuint VAO, inputVBO, indexVBO, outputVBO;
+    GLuint impactBuffer, impactTexture;
+    // current size (number of vertices and impacts) of the buffers
+    GLuint vertexCapacity, impactCapacity;
+
+    //////////////////////////////////////////
+
+    // the results of a batch are copied in the models (results is NULL if they could not be read: the models are only released)
+    void apply(GLuint index, const glm::vec3* results)
+    {
+        Batch& batch = this->batches[index];
+        for (GLuint r = 0; r < batch.numRanges; r++)
+        {
+            Range& range = batch.ranges[r];
+            if (results != NULL)
+                range.object->UpdateImpactVertices(range.indices, results + range.first * 2);
+            range.object->pendingReadbacks--;
+        }
+        batch.numRanges = 0;
+        batch.reading = false;
+    }
+
+    //////////////////////////////////////////
+
+    void setupBatch()
+    {
+        glGenVertexArrays(1, &this->VAO);
+        glGenBuffers(1, &this->inputVBO);
+        glGenBuffers(1, &this->indexVBO);
+        glGenBuffers(1, &this->outputVBO);
+        glGenBuffers(1, &this->impactBuffer);
+        glGenTextures(1, &this->impactTexture);
+
+        // the attributes are specified once: the buffers are enlarged with glBufferData, which keeps the same buffer names
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->inputVBO);
+        // vertex positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (GLvoid*)0);
+        // Normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (GLvoid*)sizeof(glm::vec3));
+        // impact indices
+        glBindBuffer(GL_ARRAY_BUFFER, this->indexVBO);
+        glEnableVertexAttribArray(5);
+        glVertexAttribIPointer(5, 1, GL_INT, sizeof(GLint), (GLvoid*)0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // the buffers are enlarged (doubling their size) if they can not contain the vertices and impacts of the batch
+    void reserve(GLuint numVertices, GLuint numImpacts)
+    {
+        if (numVertices > this->vertexCapacity)
+        {
+            while (this->vertexCapacity < numVertices)
+                this->vertexCapacity = this->vertexCapacity == 0 ? 1024 : this->vertexCapacity * 2;
+            glBindBuffer(GL_ARRAY_BUFFER, this->inputVBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * 2 * sizeof(glm::vec3), NULL, GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->indexVBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * sizeof(GLint), NULL, GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->outputVBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * 2 * sizeof(glm::vec3), NULL, GL_STREAM_COPY);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        if (numImpacts > this->impactCapacity)
+        {
+            this->impactCapacity = this->maxImpacts > numImpacts ? this->maxImpacts : numImpacts;
+            glBindBuffer(GL_TEXTURE_BUFFER, this->impactBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, this->impactCapacity * IMPACT_TEXELS * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            glBindTexture(GL_TEXTURE_BUFFER, this->impactTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->impactBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+};
@@ -0,0 +1,136 @@
+/*
+FrameArena class
+- linear allocator for the transient buffers of a frame (e.g., data packed for transform feedback, or read back from the GPU)
+- allocation is just an increment of an offset inside a block allocated once; all the allocations are released together by Reset, called at the beginning of each frame
+- buffers are allocated on the heap (not on the stack, like variable-length arrays), so large meshes do not overflow the stack
+
+If a frame needs more memory than the capacity of the block, the missing memory is allocated separately (so the application does not crash),
+and the block is enlarged at the next Reset: after the first frames, the heap is not used anymore in the frame loop.
+
+Pointers returned by Alloc are valid only until the next Reset: data needed in the next frames must be copied elsewhere.
+Objects are not constructed nor destroyed, so only plain data types (float, GLuint, glm vectors and matrices, ...) must be allocated.
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cstddef>
+
+// alignment of the allocations (enough for SIMD loads)
+#define ARENA_ALIGNMENT 16
+
+/////////////////// FRAME ARENA class ///////////////////////
+class FrameArena
+{
+public:
+    //////////////////////////////////////////
+    // Constructor (initial capacity in bytes)
+    FrameArena(size_t capacity = 4 * 1024 * 1024)
+    {
+        this->block = NULL;
+        this->capacity = 0;
+        this->offset = 0;
+        this->peak = 0;
+        this->allocate(capacity);
+    }
+
+    // destructor: the block (and the memory allocated in case of overflow) is deallocated
+    ~FrameArena()
+    {
+        this->freeOverflow();
+        delete[] this->block;
+    }
+
+    //////////////////////////////////////////
+
+    // arena shared by the application and the utility classes, to be reset once per frame
+    static FrameArena& Frame()
+    {
+        static FrameArena arena;
+        return arena;
+    }
+
+    //////////////////////////////////////////
+
+    // memory for count elements of type T. The memory is not initialized
+    template<typename T>
+    T* Alloc(size_t count)
+    {
+        size_t size = count * sizeof(T);
+        size_t start = (this->offset + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+        this->peak += size + ARENA_ALIGNMENT;
+        if (start + size <= this->capacity)
+        {
+            this->offset = start + size;
+            return (T*)(this->aligned + start);
+        }
+        // the block is full: the memory is allocated separately, and released at the next Reset
+        char* memory = new char[size + ARENA_ALIGNMENT];
+        this->overflow.push_back(memory);
+        return (T*)alignPointer(memory);
+    }
+
+    // all the allocations are released. If the last frame has needed more memory than the capacity, the block is enlarged
+    void Reset()
+    {
+        if (!this->overflow.empty())
+        {
+            this->freeOverflow();
+            this->allocate(this->peak);
+        }
+        this->offset = 0;
+        this->peak = 0;
+    }
+
+    // bytes allocated since the last Reset
+    size_t Used() const
+    {
+        return this->offset;
+    }
+
+    size_t Capacity() const
+    {
+        return this->capacity;
+    }
+
+private:
+    // memory block, and its first aligned address
+    char* block;
+    char* aligned;
+    size_t capacity;
+    // first free byte of the block
+    size_t offset;
+    // memory requested since the last Reset (used to enlarge the block)
+    size_t peak;
+    // memory allocated when the block is full
+    vector<char*> overflow;
+
+    // copy is not allowed (the block would be deallocated twice)
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+
+    //////////////////////////////////////////
+
+    void allocate(size_t capacity)
+    {
+        delete[] this->block;
+        this->block = new char[capacity + ARENA_ALIGNMENT];
+        this->aligned = alignPointer(this->block);
+        this->capacity = capacity;
+    }
+
+    void freeOverflow()
+    {
+        for (size_t i = 0; i < this->overflow.size(); i++)
+            delete[] this->overflow[i];
+        this->overflow.clear();
+    }
+
+    static char* alignPointer(char* p)
+    {
+        return (char*)(((size_t)p + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1));
+    }
+};
@@ -0,0 +1,100 @@
+/*
+ImpactBuffer class
+- history of the impacts on a deformable object, stored in a buffer texture (samplerBuffer in the vertex shader)
+- each impact uses 2 RGBA32F texels: hit point and hitting direction (xyz, in world coordinates)
+- there is no fixed maximum number of impacts: when the buffer is full, it is reallocated with double capacity, and the history is uploaded again;
+  otherwise, only the texels of the new impact are sent to the GPU
+
+Each object has its own buffer, so the vertex shader of an object loops only over the impacts on that object (numImpacts uniform).
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+/////////////////// IMPACT BUFFER class ///////////////////////
+class ImpactBuffer
+{
+public:
+    //////////////////////////////////////////
+    // Constructor
+    ImpactBuffer()
+    {
+        this->buffer = 0;
+        this->texture = 0;
+        this->capacity = 0;
+    }
+
+    //////////////////////////////////////////
+
+    // a new impact is added to the history
+    void Add(const glm::vec3& point, const glm::vec3& direction)
+    {
+        if (this->buffer == 0)
+        {
+            glGenBuffers(1, &this->buffer);
+            glGenTextures(1, &this->texture);
+        }
+
+        this->texels.push_back(glm::vec4(point, 1.0f));
+        this->texels.push_back(glm::vec4(direction, 0.0f));
+
+        glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+        if (this->texels.size() > this->capacity)
+        {
+            // the buffer is enlarged, and all the history is uploaded
+            this->capacity = this->capacity == 0 ? 64 : this->capacity * 2;
+            glBufferData(GL_TEXTURE_BUFFER, this->capacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, this->texels.size() * sizeof(glm::vec4), &this->texels[0]);
+            glBindTexture(GL_TEXTURE_BUFFER, this->texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->buffer);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+        else
+            glBufferSubData(GL_TEXTURE_BUFFER, (this->texels.size() - 2) * sizeof(glm::vec4), 2 * sizeof(glm::vec4), &this->texels[this->texels.size() - 2]);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // number of impacts
+    GLuint Size() const
+    {
+        return this->texels.size() / 2;
+    }
+
+    // the buffer texture is bound to the texture unit, and the sampler and the number of impacts are set in the shader
+    void Bind(GLuint programID, GLuint unit, const string& samplerName, const string& countName) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, this->texture);
+        glUniform1i(glGetUniformLocation(programID, samplerName.c_str()), unit);
+        glUniform1i(glGetUniformLocation(programID, countName.c_str()), this->Size());
+    }
+
+    //////////////////////////////////////////
+
+    // buffers are deallocated when application ends
+    void Delete()
+    {
+        if (this->buffer == 0)
+            return;
+        glDeleteBuffers(1, &this->buffer);
+        glDeleteTextures(1, &this->texture);
+        this->buffer = 0;
+        this->texture = 0;
+    }
+
+private:
+    // CPU copy of the history (2 texels for each impact)
+    vector<glm::vec4> texels;
+    // buffer object and buffer texture
+    GLuint buffer, texture;
+    // number of texels that the buffer can contain
+    GLuint capacity;
+};
@@ -0,0 +1,239 @@
+/*
+ImpactQueue class
+- stream of impact events, produced by the physics simulation and consumed by the deformation stage
+- after each simulation step, Capture scans all the contact manifolds of the dynamics world, and records every new contact point
+  (pair of bodies, world point, normal, applied impulse and time) in a ring buffer allocated once, at construction
+- the deformation stage drains the events in batches (Pop), so all the simultaneous hits are applied, and not only the last one
+- alternatively (Listen), contacts are recorded by Bullet's gContactAddedCallback, called during the collision detection when a contact point is added to
+  (or refreshed in) a manifold. Bullet calls it only for the objects with the CF_CUSTOM_MATERIAL_CALLBACK flag (see Watch), and only the contacts
+  between two given collision groups are recorded: the cost depends on the number of contacts of the watched objects, and not on the total number of manifolds.
+  The solver has not run yet when the callback is called, so the impulses of the new points are read at the end of the step (only in the steps with new points)
+
+Contact points are not removed from the manifolds (Bullet keeps them between steps, to improve the stability of the simulation):
+a point already recorded is marked using its m_userPersistentData field, which Bullet preserves while the point persists, and resets when a new point is created.
+N.B.) so gContactDestroyedCallback must not be set (Bullet would call it with the marked points)
+
+If the buffer is full, new events are discarded (and counted, see Dropped).
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <bullet/btBulletDynamicsCommon.h>
+
+// data structure for an impact event
+struct ImpactEvent {
+    // pair of colliding bodies
+    const btCollisionObject* BodyA;
+    const btCollisionObject* BodyB;
+    // contact point (on body A) in world coordinates
+    glm::vec3 Point;
+    // contact normal in world coordinates (on body B, pointing towards body A)
+    glm::vec3 Normal;
+    // impulse applied by the solver to resolve the contact (with Listen, it is read at the end of the step which generated the contact;
+    // it is 0 if Bullet has discarded the point before the solver)
+    float Impulse;
+    // time of the simulation step which generated the contact (with Listen, simulation time since the call of Listen)
+    double Time;
+};
+
+/////////////////// IMPACT QUEUE class ///////////////////////
+class ImpactQueue
+{
+public:
+    //////////////////////////////////////////
+    // Constructor (maximum number of events waiting to be processed)
+    ImpactQueue(GLuint capacity = 1024)
+    {
+        this->events.resize(capacity);
+        this->first = 0;
+        this->count = 0;
+        this->dropped = 0;
+        this->time = 0.0;
+        this->pendingImpulses = 0;
+    }
+
+    //////////////////////////////////////////
+
+    // the new contact points of the dynamics world are added to the queue. It must be called after each simulation step.
+    // It returns the number of recorded events
+    int Capture(btDynamicsWorld* world, double time)
+    {
+        int recorded = 0;
+        btDispatcher* dispatcher = world->getDispatcher();
+        int numManifolds = dispatcher->getNumManifolds();
+        for (int i = 0; i < numManifolds; i++)
+        {
+            btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+            for (int j = 0; j < manifold->getNumContacts(); j++)
+            {
+                if (this->record(manifold->getContactPoint(j), manifold->getBody0(), manifold->getBody1(), time))
+                    recorded++;
+            }
+        }
+        return recorded;
+    }
+
+    // the new contacts between an object of groupA and an object of groupB (collision filter groups, see utils/physics.h) are recorded
+    // by the contact callback of Bullet, during the simulation steps of the world. Capture is not needed anymore.
+    // Only one queue at a time can listen (the callback of Bullet is a global function)
+    void Listen(btDynamicsWorld* world, int groupA, int groupB)
+    {
+        this->groupA = groupA;
+        this->groupB = groupB;
+        ImpactQueue::listener() = this;
+        gContactAddedCallback = ImpactQueue::contactAdded;
+        // the time of the events is updated before each step, and the impulses of the new points are read after it
+        world->setInternalTickCallback(ImpactQueue::preTick, this, true);
+        world->setInternalTickCallback(ImpactQueue::postTick, this, false);
+    }
+
+    // Bullet calls the contact callback only for the objects with the CF_CUSTOM_MATERIAL_CALLBACK flag (e.g., the deformable objects)
+    void Watch(btCollisionObject* obj)
+    {
+        obj->setCollisionFlags(obj->getCollisionFlags() | btCollisionObject::CF_CUSTOM_MATERIAL_CALLBACK);
+    }
+
+    // an event is added to the queue. It returns false if the queue is full (and the event is discarded)
+    bool Push(const ImpactEvent& e)
+    {
+        if (this->count == this->events.size())
+        {
+            this->dropped++;
+            return false;
+        }
+        this->events[(this->first + this->count) % this->events.size()] = e;
+        this->count++;
+        return true;
+    }
+
+    // at most maxEvents events are removed from the queue (in the same order they were added), and copied in out.
+    // It returns the number of copied events
+    GLuint Pop(ImpactEvent* out, GLuint maxEvents)
+    {
+        GLuint n = 0;
+        for (; n < maxEvents && this->count > 0; n++)
+        {
+            out[n] = this->events[this->first];
+            this->first = (this->first + 1) % this->events.size();
+            this->count--;
+        }
+        return n;
+    }
+
+    // number of events waiting to be processed
+    GLuint Size() const
+    {
+        return this->count;
+    }
+
+    // number of events discarded because the queue was full
+    GLuint Dropped() const
+    {
+        return this->dropped;
+    }
+
+private:
+    // ring buffer of events
+    vector<ImpactEvent> events;
+    // oldest event, and number of events in the queue
+    GLuint first;
+    GLuint count;
+    GLuint dropped;
+    // with Listen: collision groups of the recorded contacts, and simulation time
+    int groupA, groupB;
+    double time;
+    // with Listen: number of events recorded in the current step, whose impulse must be read after the solver
+    GLuint pendingImpulses;
+
+    //////////////////////////////////////////
+
+    // the contact point is added to the queue, if it has not already been recorded, and if the bodies are touching
+    // (otherwise, it will be recorded when they touch). If pendingImpulse is true, the point is marked with its event, whose impulse is
+    // read by readImpulses after the solver. It returns true if the point is recorded
+    bool record(btManifoldPoint& pt, const btCollisionObject* bodyA, const btCollisionObject* bodyB, double time, bool pendingImpulse = false)
+    {
+        if (pt.m_userPersistentData != 0 || pt.getDistance() > 0.0f)
+            return false;
+        pt.m_userPersistentData = this;
+
+        const btVector3& p = pt.getPositionWorldOnA();
+        const btVector3& n = pt.m_normalWorldOnB;
+        ImpactEvent e = {bodyA, bodyB, glm::vec3(p.x(), p.y(), p.z()), glm::vec3(n.x(), n.y(), n.z()), pt.getAppliedImpulse(), time};
+        if (!this->Push(e))
+            return false;
+        if (pendingImpulse)
+        {
+            pt.m_userPersistentData = &this->events[(this->first + this->count - 1) % this->events.size()];
+            this->pendingImpulses++;
+        }
+        return true;
+    }
+
+    // the impulses computed by the solver are copied in the events of the points recorded in this step (the points marked with an event),
+    // and the points are marked as recorded
+    void readImpulses(btDynamicsWorld* world)
+    {
+        ImpactEvent* begin = &this->events[0];
+        ImpactEvent* end = begin + this->events.size();
+        btDispatcher* dispatcher = world->getDispatcher();
+        int numManifolds = dispatcher->getNumManifolds();
+        for (int i = 0; i < numManifolds && this->pendingImpulses > 0; i++)
+        {
+            btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+            for (int j = 0; j < manifold->getNumContacts(); j++)
+            {
+                btManifoldPoint& pt = manifold->getContactPoint(j);
+                ImpactEvent* e = (ImpactEvent*)pt.m_userPersistentData;
+                if (e >= begin && e < end)
+                {
+                    e->Impulse = pt.getAppliedImpulse();
+                    pt.m_userPersistentData = this;
+                    this->pendingImpulses--;
+                }
+            }
+        }
+        // the points discarded by Bullet before the solver keep a null impulse
+        this->pendingImpulses = 0;
+    }
+
+    // queue which receives the contacts of the callback
+    static ImpactQueue*& listener()
+    {
+        static ImpactQueue* queue = NULL;
+        return queue;
+    }
+
+    // called by Bullet when a contact point is added to a manifold, or refreshed (object 0 is the body A of the point)
+    static bool contactAdded(btManifoldPoint& cp, const btCollisionObjectWrapper* colObj0Wrap, int partId0, int index0,
+                             const btCollisionObjectWrapper* colObj1Wrap, int partId1, int index1)
+    {
+        ImpactQueue* queue = ImpactQueue::listener();
+        const btCollisionObject* bodyA = colObj0Wrap->getCollisionObject();
+        const btCollisionObject* bodyB = colObj1Wrap->getCollisionObject();
+        int groupA = bodyA->getBroadphaseHandle()->m_collisionFilterGroup;
+        int groupB = bodyB->getBroadphaseHandle()->m_collisionFilterGroup;
+        if (((groupA & queue->groupA) && (groupB & queue->groupB)) || ((groupA & queue->groupB) && (groupB & queue->groupA)))
+            queue->record(cp, bodyA, bodyB, queue->time, true);
+        // friction and restitution are not modified
+        return false;
+    }
+
+    static void preTick(btDynamicsWorld* world, btScalar timeStep)
+    {
+        ((ImpactQueue*)world->getWorldUserInfo())->time += timeStep;
+    }
+
+    static void postTick(btDynamicsWorld* world, btScalar timeStep)
+    {
+        ImpactQueue* queue = (ImpactQueue*)world->getWorldUserInfo();
+        if (queue->pendingImpulses > 0)
+            queue->readImpulses(world);
+    }
+};
@@ -0,0 +1,378 @@
+/*
+MeshCache class
+- binary cache of the meshes of a model, written after the first import with Assimp (see Model::loadModel), next to the model file (<model file>.meshcache)
+- the cache contains the final vertex and index arrays of each mesh (the same data sent to the VBO and EBO), and the textures of its materials (type and file):
+  in the following runs, the file is memory mapped, and the arrays are used directly (by glBufferData, and by a single copy in the CPU vectors of the Mesh),
+  so Assimp import, post-processing and the per-attribute conversion of the vertices are skipped
+- the cache is versioned: it is used only if it has been written by the same version of the format, with the same Vertex layout and import flags,
+  and if size and modification time of the model file are the ones saved in the cache. Otherwise, the model is imported again, and the cache is rewritten
+
+Layout of the file: header, mesh entries, texture entries, then the vertex and index arrays (each array starts at a 16 bytes aligned offset).
+
+The MappedFile class (read-only memory mapping of a file: CreateFileMapping on Windows, mmap elsewhere) is used to read the cache.
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// GL Includes
+#include <glad/glad.h>
+
+// version of the format of the cache: it must be incremented when the layout of the file, or the processing of the meshes, is changed
+const GLuint MESH_CACHE_VERSION = 1;
+
+// data structure for the header of the cache
+struct MeshCacheHeader {
+    // "RTMC"
+    char Magic[4];
+    GLuint Version;
+    // sizeof(Vertex), and Assimp post-processing flags used for the import
+    GLuint VertexSize;
+    GLuint ImportFlags;
+    // size and modification time of the model file
+    long long SourceSize;
+    long long SourceTime;
+    GLuint NumMeshes;
+    GLuint NumTextures;
+};
+
+// data structure for a mesh in the cache
+struct MeshCacheEntry {
+    GLuint NumVertices;
+    GLuint NumIndices;
+    // textures of the mesh: NumTextures entries, starting from FirstTexture
+    GLuint FirstTexture;
+    GLuint NumTextures;
+    // offsets of the vertex and index arrays, from the beginning of the file
+    unsigned long long VertexOffset;
+    unsigned long long IndexOffset;
+};
+
+// data structure for a texture in the cache (type, e.g. "texture_diffuse", and file, relative to the folder of the model)
+struct MeshCacheTexture {
+    char Type[32];
+    char Path[224];
+};
+
+/////////////////// MAPPED FILE class ///////////////////////
+// read-only view of a file in memory
+class MappedFile
+{
+public:
+    MappedFile()
+    {
+        this->data = NULL;
+        this->size = 0;
+#ifdef _WIN32
+        this->file = INVALID_HANDLE_VALUE;
+        this->mapping = NULL;
+#endif
+    }
+
+    ~MappedFile()
+    {
+        this->Close();
+    }
+
+    // the file is mapped in memory. It returns false if the file does not exist, or it is empty
+    bool Open(const string& path)
+    {
+        this->Close();
+#ifdef _WIN32
+        this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (this->file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            this->Close();
+            return false;
+        }
+        this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (this->mapping == NULL)
+        {
+            this->Close();
+            return false;
+        }
+        this->data = (const unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+        this->size = (size_t)fileSize.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps the file open
+        close(fd);
+        this->data = (view == MAP_FAILED) ? NULL : (const unsigned char*)view;
+        this->size = info.st_size;
+#endif
+        if (this->data == NULL)
+        {
+            this->Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (this->data)
+            UnmapViewOfFile(this->data);
+        if (this->mapping)
+            CloseHandle(this->mapping);
+        if (this->file != INVALID_HANDLE_VALUE)
+            CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+        this->mapping = NULL;
+#else
+        if (this->data)
+            munmap((void*)this->data, this->size);
+#endif
+        this->data = NULL;
+        this->size = 0;
+    }
+
+    const unsigned char* Data() const
+    {
+        return this->data;
+    }
+
+    size_t Size() const
+    {
+        return this->size;
+    }
+
+private:
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+    // copy is not allowed (the file would be unmapped twice)
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+/////////////////// MESH CACHE class ///////////////////////
+class MeshCache
+{
+public:
+    //////////////////////////////////////////
+
+    // file of the cache of a model
+    static string CachePath(const string& modelPath)
+    {
+        return modelPath + ".meshcache";
+    }
+
+    // the cache of the model is mapped in memory. It returns false if the cache does not exist, or it is not valid for the model file
+    // (then, the model must be imported with Assimp)
+    bool Open(const string& modelPath, GLuint importFlags)
+    {
+        MeshCacheHeader expected;
+        if (!MeshCache::makeHeader(modelPath, importFlags, expected))
+            return false;
+        if (!this->file.Open(MeshCache::CachePath(modelPath)))
+            return false;
+
+        const MeshCacheHeader* header = (const MeshCacheHeader*)this->file.Data();
+        bool valid = this->file.Size() >= sizeof(MeshCacheHeader) && memcmp(header->Magic, expected.Magic, 4) == 0 && header->Version == expected.Version &&
+                     header->VertexSize == expected.VertexSize && header->ImportFlags == expected.ImportFlags &&
+                     header->SourceSize == expected.SourceSize && header->SourceTime == expected.SourceTime;
+        // the entries and the arrays must be inside the file (e.g., if the writing of the cache has been interrupted)
+        if (valid)
+        {
+            size_t tables = sizeof(MeshCacheHeader) + header->NumMeshes * sizeof(MeshCacheEntry) + header->NumTextures * sizeof(MeshCacheTexture);
+            valid = tables <= this->file.Size();
+            for (GLuint i = 0; valid && i < header->NumMeshes; i++)
+            {
+                const MeshCacheEntry& e = this->entries()[i];
+                valid = e.VertexOffset + (unsigned long long)e.NumVertices * sizeof(Vertex) <= this->file.Size() &&
+                        e.IndexOffset + (unsigned long long)e.NumIndices * sizeof(GLuint) <= this->file.Size() &&
+                        e.FirstTexture + e.NumTextures <= header->NumTextures;
+            }
+        }
+        if (!valid)
+        {
+            this->file.Close();
+            return false;
+        }
+        return true;
+    }
+
+    // the cache is unmapped (the data of the meshes must have been copied)
+    void Close()
+    {
+        this->file.Close();
+    }
+
+    // true if the cache is mapped (between a successful Open and Close)
+    bool IsOpen() const
+    {
+        return this->file.Data() != NULL;
+    }
+
+    //////////////////////////////////////////
+
+    GLuint NumMeshes() const
+    {
+        return ((const MeshCacheHeader*)this->file.Data())->NumMeshes;
+    }
+
+    const MeshCacheEntry& Entry(GLuint mesh) const
+    {
+        return this->entries()[mesh];
+    }
+
+    // vertex and index arrays of a mesh (pointers to the mapped file)
+    const Vertex* Vertices(GLuint mesh) const
+    {
+        return (const Vertex*)(this->file.Data() + this->Entry(mesh).VertexOffset);
+    }
+
+    const GLuint* Indices(GLuint mesh) const
+    {
+        return (const GLuint*)(this->file.Data() + this->Entry(mesh).IndexOffset);
+    }
+
+    // i-th texture of a mesh
+    const MeshCacheTexture& MeshTexture(GLuint mesh, GLuint i) const
+    {
+        const MeshCacheHeader* header = (const MeshCacheHeader*)this->file.Data();
+        const MeshCacheTexture* textures = (const MeshCacheTexture*)(this->entries() + header->NumMeshes);
+        return textures[this->Entry(mesh).FirstTexture + i];
+    }
+
+    //////////////////////////////////////////
+
+    // the cache of the model is written with the vertices, indices and textures of the meshes (Mesh, or MeshData before the upload, see Model::Parse).
+    // It returns false if the file cannot be written
+    template <class MeshType>
+    static bool Write(const string& modelPath, GLuint importFlags, const vector<MeshType>& meshes)
+    {
+        MeshCacheHeader header;
+        if (!MeshCache::makeHeader(modelPath, importFlags, header))
+            return false;
+
+        vector<MeshCacheEntry> entries(meshes.size());
+        vector<MeshCacheTexture> textures;
+        unsigned long long offset = sizeof(MeshCacheHeader) + meshes.size() * sizeof(MeshCacheEntry);
+        for (GLuint i = 0; i < meshes.size(); i++)
+            offset += meshes[i].textures.size() * sizeof(MeshCacheTexture);
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            entries[i].NumVertices = meshes[i].vertices.size();
+            entries[i].NumIndices = meshes[i].indices.size();
+            entries[i].FirstTexture = textures.size();
+            entries[i].NumTextures = meshes[i].textures.size();
+            for (GLuint j = 0; j < meshes[i].textures.size(); j++)
+            {
+                MeshCacheTexture t;
+                memset(&t, 0, sizeof(t));
+                strncpy(t.Type, meshes[i].textures[j].type.c_str(), sizeof(t.Type) - 1);
+                strncpy(t.Path, meshes[i].textures[j].path.C_Str(), sizeof(t.Path) - 1);
+                textures.push_back(t);
+            }
+            offset = MeshCache::align(offset);
+            entries[i].VertexOffset = offset;
+            offset = MeshCache::align(offset + entries[i].NumVertices * sizeof(Vertex));
+            entries[i].IndexOffset = offset;
+            offset += entries[i].NumIndices * sizeof(GLuint);
+        }
+        header.NumMeshes = meshes.size();
+        header.NumTextures = textures.size();
+
+        ofstream out(MeshCache::CachePath(modelPath).c_str(), ios::binary | ios::trunc);
+        if (!out)
+        {
+            cout << "WARNING::MESH_CACHE:: cannot write the cache of " << modelPath << endl;
+            return false;
+        }
+        out.write((const char*)&header, sizeof(header));
+        if (!entries.empty())
+            out.write((const char*)&entries[0], entries.size() * sizeof(MeshCacheEntry));
+        if (!textures.empty())
+            out.write((const char*)&textures[0], textures.size() * sizeof(MeshCacheTexture));
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            MeshCache::pad(out, entries[i].VertexOffset);
+            if (entries[i].NumVertices)
+                out.write((const char*)&meshes[i].vertices[0], entries[i].NumVertices * sizeof(Vertex));
+            MeshCache::pad(out, entries[i].IndexOffset);
+            if (entries[i].NumIndices)
+                out.write((const char*)&meshes[i].indices[0], entries[i].NumIndices * sizeof(GLuint));
+        }
+        return out.good();
+    }
+
+private:
+    MappedFile file;
+
+    //////////////////////////////////////////
+
+    const MeshCacheEntry* entries() const
+    {
+        return (const MeshCacheEntry*)(this->file.Data() + sizeof(MeshCacheHeader));
+    }
+
+    // header for the current version of the format, and the current state of the model file. It returns false if the model file does not exist
+    static bool makeHeader(const string& modelPath, GLuint importFlags, MeshCacheHeader& header)
+    {
+        struct stat info;
+        if (stat(modelPath.c_str(), &info) != 0)
+            return false;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.Magic, "RTMC", 4);
+        header.Version = MESH_CACHE_VERSION;
+        header.VertexSize = sizeof(Vertex);
+        header.ImportFlags = importFlags;
+        header.SourceSize = info.st_size;
+        header.SourceTime = info.st_mtime;
+        return true;
+    }
+
+    static unsigned long long align(unsigned long long offset)
+    {
+        return (offset + 15) & ~15ULL;
+    }
+
+    // zeros are written until the given offset
+    static void pad(ofstream& out, unsigned long long offset)
+    {
+        static const char zeros[16] = {0};
+        unsigned long long position = out.tellp();
+        if (offset > position)
+            out.write(zeros, offset - position);
+    }
+};
@@ -0,0 +1,125 @@
+/*
+MeshCollider class
+- Bullet collision shape (btBvhTriangleMeshShape) built directly on the vertex data of the meshes of a model:
+  a btTriangleIndexVertexArray points at the Position field of the Vertex structs (stride sizeof(Vertex)) and at the indices of each Mesh,
+  so no copy of the geometry is made, and the shape always sees the current (deformed) positions
+- after a deformation, only the part of the BVH overlapping the touched AABB is refit (partialRefitTree), instead of rebuilding the whole tree
+
+The BVH uses quantized AABBs, so the quantization bounds are computed once, at construction: they are the AABB of the meshes, enlarged by a growth factor,
+to leave room for the deformations. Refit boxes are clamped to these bounds.
+
+The vertices and indices vectors of the meshes must not be reallocated while the collider is used (or the collider must be moved to the new arrays, see Rebind).
+The shape is scaled by the scale of the model matrix used for rendering (Bullet shapes are in world units).
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include <bullet/btBulletDynamicsCommon.h>
+
+/////////////////// MESH COLLIDER class ///////////////////////
+class MeshCollider
+{
+public:
+    // view over the vertices and indices of the meshes
+    btTriangleIndexVertexArray* meshInterface;
+    // triangle mesh shape, with its BVH
+    btBvhTriangleMeshShape* shape;
+
+    //////////////////////////////////////////
+    // Constructor (meshes of the model, scale of the model, enlargement of the quantization bounds w.r.t. the size of the meshes)
+    MeshCollider(vector<Mesh>& meshes, const glm::vec3& scale, float growth = 0.5f)
+    {
+        this->scaling = btVector3(scale.x, scale.y, scale.z);
+        this->meshInterface = new btTriangleIndexVertexArray();
+
+        glm::vec3 aabbMin = glm::vec3(1e30f), aabbMax = glm::vec3(-1e30f);
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            if (meshes[i].indices.empty())
+                continue;
+
+            btIndexedMesh part;
+            part.m_numTriangles = meshes[i].indices.size() / 3;
+            part.m_triangleIndexBase = (const unsigned char*)&meshes[i].indices[0];
+            part.m_triangleIndexStride = 3 * sizeof(GLuint);
+            part.m_numVertices = meshes[i].vertices.size();
+            part.m_vertexBase = (const unsigned char*)&meshes[i].vertices[0].Position;
+            part.m_vertexStride = sizeof(Vertex);
+            part.m_vertexType = PHY_FLOAT;
+            this->meshInterface->addIndexedMesh(part, PHY_INTEGER);
+
+            for (GLuint j = 0; j < meshes[i].vertices.size(); j++)
+            {
+                aabbMin = glm::min(aabbMin, meshes[i].vertices[j].Position);
+                aabbMax = glm::max(aabbMax, meshes[i].vertices[j].Position);
+            }
+        }
+        this->meshInterface->setScaling(this->scaling);
+
+        // quantization bounds (in scaled coordinates)
+        glm::vec3 room = (aabbMax - aabbMin) * growth;
+        this->bvhMin = this->toBullet(aabbMin - room);
+        this->bvhMax = this->toBullet(aabbMax + room);
+
+        this->shape = new btBvhTriangleMeshShape(this->meshInterface, true, this->bvhMin, this->bvhMax);
+    }
+
+    //////////////////////////////////////////
+
+    // the BVH nodes overlapping the box (in model coordinates) are refit with the current positions of the vertices
+    void Refit(const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+    {
+        btVector3 refitMin = this->toBullet(aabbMin), refitMax = this->toBullet(aabbMax);
+        // Bullet requires the box to be inside the quantization bounds
+        refitMin.setMax(this->bvhMin);
+        refitMax.setMin(this->bvhMax);
+        if (refitMin.x() > refitMax.x() || refitMin.y() > refitMax.y() || refitMin.z() > refitMax.z())
+            return;
+        this->shape->partialRefitTree(refitMin, refitMax);
+    }
+
+    // the shape is moved to the arrays of other meshes with the same vertices and indices (e.g., the copy of a shared model, see Model::makeUnique).
+    // The BVH does not change
+    void Rebind(vector<Mesh>& meshes)
+    {
+        IndexedMeshArray& parts = this->meshInterface->getIndexedMeshArray();
+        int k = 0;
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            if (meshes[i].indices.empty())
+                continue;
+            parts[k].m_triangleIndexBase = (const unsigned char*)&meshes[i].indices[0];
+            parts[k].m_vertexBase = (const unsigned char*)&meshes[i].vertices[0].Position;
+            k++;
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // the mesh interface is deallocated when application ends (the shape is owned by the Physics class, see Physics::createRigidBody)
+    void Delete()
+    {
+        delete this->meshInterface;
+        this->meshInterface = NULL;
+    }
+
+private:
+    // scale applied to the vertices, and quantization bounds of the BVH (in scaled coordinates)
+    btVector3 scaling;
+    btVector3 bvhMin, bvhMax;
+
+    //////////////////////////////////////////
+
+    // point in model coordinates -> point in the (scaled) coordinates of the shape
+    btVector3 toBullet(const glm::vec3& p) const
+    {
+        return btVector3(p.x, p.y, p.z) * this->scaling;
+    }
+};
@@ -9,7 +9,16 @@ See https://learnopengl.com/#!Getting-started/Hello-Triangle for details.
 
 N.B. 1) in this version of the class, textures are loaded and applied
 
-N.B. 2) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/mesh.h
+N.B. 2) positions and normals can be kept on the GPU (SetGpuResident): each mesh owns two additional buffers with interleaved (position, normal) pairs,
+used alternately as source and destination of the transform feedback deformation (DeformOnGpu), and the mesh is rendered directly from the latest one.
+The CPU copy (vertices and streams) is updated only when requested (ReadBack), e.g. for physics or saving.
+
+N.B. 3) a mesh can use a packed layout of the VBO (PackedVertex, chosen when the mesh is created): positions stay in full precision,
+because they are deformed, while normals, tangents and bitangents are signed normalized 10:10:10:2 integers, and texture coordinates half floats.
+The attributes are converted to floats by the vertex fetch, so the shaders are the same for both layouts. The CPU copy (vertices) is always
+in the full layout, and it is packed when it is sent to the GPU.
+
+N.B. 4) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/mesh.h
 
 author: Davide Gadia
 
@@ -28,11 +37,13 @@ using namespace std;
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 // GL Includes
 #include <glad/glad.h> // Contains all the necessery OpenGL includes
 // we use GLM data structures to write data in the VBO, VAO and EBO buffers
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 
 // data structure for vertices
 struct Vertex {
@@ -48,6 +59,45 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// data structure for vertices in the packed layout of the VBO (28 bytes instead of the 56 of Vertex)
+struct PackedVertex {
+    // vertex coordinates (full precision, they are deformed)
+    glm::vec3 Position;
+    // Normal, Tangent and Bitangent: GL_INT_2_10_10_10_REV, normalized
+    GLuint Normal;
+    // Texture coordinates: two half floats
+    GLuint TexCoords;
+    GLuint Tangent;
+    GLuint Bitangent;
+};
+
+// a direction is packed in 10:10:10:2 signed normalized integers (it is normalized first: the precision is about 0.001 for each component)
+inline GLuint PackDirection(const glm::vec3& v)
+{
+    float length = glm::length(v);
+    return glm::packSnorm3x10_1x2(glm::vec4(length > 0.0f ? v / length : v, 0.0f));
+}
+
+// conversion of a vertex to the packed layout
+inline PackedVertex PackVertex(const Vertex& v)
+{
+    PackedVertex p;
+    p.Position = v.Position;
+    p.Normal = PackDirection(v.Normal);
+    p.TexCoords = glm::packHalf2x16(v.TexCoords);
+    p.Tangent = PackDirection(v.Tangent);
+    p.Bitangent = PackDirection(v.Bitangent);
+    return p;
+}
+
+// structure-of-arrays copy of positions and normals, used by the deformation kernels
+#include <utils/vertex_streams.h>
+// linear allocator for the transient buffers of a frame
+#include <utils/frame_arena.h>
+
+// maximum number of unchanged vertices between two dirty vertices in the same span sent to the GPU (see Mesh::UpdateMesh)
+#define DIRTY_GAP 16
+
 // data structure for textures
 struct Texture {
     GLuint id;
@@ -63,20 +113,50 @@ public:
     vector<GLuint> indices;
     // data structures for textures
     vector<Texture> textures;
+    // SoA copy of positions and normals (kept in sync with vertices)
+    VertexStreams streams;
 
     // VAO
     GLuint VAO;
+    // if true, positions and normals used for rendering are in the ping-pong buffers, and the CPU copy can be out of date
+    bool gpuResident;
+    // if true, the VBO uses the packed layout (PackedVertex)
+    bool packed;
 
     //////////////////////////////////////////
-    // Constructor
-    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+    // Constructor (packed = layout of the VBO, see PackedVertex)
+    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, bool packed = false)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->streams.Build(this->vertices);
+        this->gpuResident = false;
+        this->packed = packed;
+        this->sharedIndices = false;
+        this->current = 0;
+        this->deformVBO[0] = this->deformVBO[1] = 0;
 
         // initialization of OpenGL buffers
-        this->setupMesh();
+        this->setupMesh(&this->vertices[0], &this->indices[0]);
+    }
+
+    // constructor from vertex and index arrays (e.g., memory mapped from a cache file, see utils/mesh_cache.h):
+    // the arrays are copied with a single copy in the vectors, and uploaded directly to the GPU
+    Mesh(const Vertex* vertices, GLuint numVertices, const GLuint* indices, GLuint numIndices, vector<Texture> textures, bool packed = false)
+    {
+        this->vertices.assign(vertices, vertices + numVertices);
+        this->indices.assign(indices, indices + numIndices);
+        this->textures = textures;
+        this->streams.Build(this->vertices);
+        this->gpuResident = false;
+        this->packed = packed;
+        this->sharedIndices = false;
+        this->current = 0;
+        this->deformVBO[0] = this->deformVBO[1] = 0;
+
+        // initialization of OpenGL buffers
+        this->setupMesh(vertices, indices);
     }
 
     //////////////////////////////////////////
@@ -111,8 +191,8 @@ public:
             glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
         }
 
-        // VAO is made "active"
-        glBindVertexArray(this->VAO);
+        // VAO is made "active" (if data are on the GPU, we use the VAO of the last ping-pong buffer written by transform feedback)
+        glBindVertexArray(this->gpuResident ? this->deformVAO[this->current] : this->VAO);
         // rendering of data in the VAO
         glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
         // VAO is "detached"
@@ -126,35 +206,175 @@ public:
         }
     }
     
+    // positions and normals captured by transform feedback (interleaved (position, normal) pairs, one for each vertex) are copied in the mesh.
+    // Only the vertices whose position has changed are updated, and data are sent to the GPU only if at least one vertex has changed.
+    // It returns the number of changed vertices.
+    int ApplyFeedback(const glm::vec3* data)
+    {
+        int n = this->streams.FindChanged(data, this->changed);
+        for (int k = 0; k < n; k++)
+        {
+            GLuint j = this->changed[k];
+            this->streams.Set(j, data[j*2], data[j*2 + 1]);
+            this->streams.Store(this->vertices, j);
+            this->MarkDirty(j);
+        }
+        this->UpdateMesh();
+        return n;
+    }
+
+    // indices of the vertices changed by the last call of ApplyFeedback
+    const vector<GLuint>& Changed() const
+    {
+        return this->changed;
+    }
+
+    // the i-th vertex has been modified on the CPU, and it must be sent to the GPU at the next call of UpdateMesh
+    void MarkDirty(GLuint i)
+    {
+        this->dirty.push_back(i);
+    }
+
+    // only the vertices marked as dirty are sent to the GPU: they are sorted, and grouped in spans of (almost) consecutive vertices,
+    // which are copied in the VBO with glBufferSubData. The EBO is never touched, because indices do not change after the loading.
+    // The amount of data sent to the GPU is then proportional to the number of modified vertices, and not to the size of the mesh.
     void UpdateMesh()
     {
-        // VAO is made "active"
-        glBindVertexArray(this->VAO);
-        // we copy data in the VBO - we must set the data dimension, and the pointer to the structure cointaining the data
+        if (this->dirty.empty())
+            return;
+
+        sort(this->dirty.begin(), this->dirty.end());
         glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-        // we copy data in the EBO - we must set the data dimension, and the pointer to the structure cointaining the data
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-        // we set in the VAO the pointers to the different vertex attributes (with the relative offsets inside the data structure)
-        // vertex positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-        // Normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-        // Texture Coordinates
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-        // Tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
-        // Bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
+        GLuint first = this->dirty[0];
+        GLuint last = first;
+        for (GLuint k = 1; k <= this->dirty.size(); k++)
+        {
+            // two spans closer than DIRTY_GAP vertices are merged: sending few unchanged vertices is cheaper than an additional call
+            if (k < this->dirty.size() && this->dirty[k] <= last + DIRTY_GAP)
+            {
+                last = this->dirty[k];
+                continue;
+            }
+            if (this->packed)
+            {
+                PackedVertex* data = FrameArena::Frame().Alloc<PackedVertex>(last - first + 1);
+                for (GLuint j = first; j <= last; j++)
+                    data[j - first] = PackVertex(this->vertices[j]);
+                glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(PackedVertex), (last - first + 1) * sizeof(PackedVertex), data);
+            }
+            else
+                glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Vertex), (last - first + 1) * sizeof(Vertex), &this->vertices[first]);
+            if (k < this->dirty.size())
+                first = last = this->dirty[k];
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        this->dirty.clear();
+    }
+
+    //////////////////////////////////////////
 
+    // moves the positions and normals used for rendering and deformation between CPU and GPU.
+    // When enabled, the current CPU data are copied in the ping-pong buffers (created the first time);
+    // when disabled, the GPU data are read back, so the CPU copy and the VBO are up to date
+    void SetGpuResident(bool resident)
+    {
+        if (resident == this->gpuResident)
+            return;
+        if (resident)
+        {
+            if (this->deformVBO[0] == 0)
+                this->setupPingPong();
+            this->current = 0;
+            // interleaved (position, normal) pairs, as written by transform feedback
+            glm::vec3* data = FrameArena::Frame().Alloc<glm::vec3>(this->vertices.size() * 2);
+            for (GLuint i = 0; i < this->vertices.size(); i++)
+            {
+                data[i*2] = this->streams.Position(i);
+                data[i*2 + 1] = this->streams.Normal(i);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, this->deformVBO[this->current]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, this->vertices.size() * 2 * sizeof(glm::vec3), data);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        else
+            this->ReadBack();
+        this->gpuResident = resident;
+    }
+
+    // deformation of all the vertices with transform feedback, reading from the current ping-pong buffer and writing in the other one,
+    // which then becomes the current one. No data is transferred between CPU and GPU.
+    // The feedback shader must be active, with its uniforms already set, and it must read position and normal at locations 0 and 1
+    void DeformOnGpu()
+    {
+        if (!this->gpuResident)
+            return;
+        GLuint next = 1 - this->current;
+
+        glBindVertexArray(this->deformVAO[this->current]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, this->deformVBO[next]);
+        glEnable(GL_RASTERIZER_DISCARD);
+        // one point for each vertex
+        glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, this->vertices.size());
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
         glBindVertexArray(0);
+
+        this->current = next;
+    }
+
+    // the CPU copy of positions and normals is updated with the data of the current ping-pong buffer.
+    // This is the only point where data are read from the GPU, so it must be called only when the CPU data are really needed.
+    // It returns the number of changed vertices (their indices are in Changed())
+    int ReadBack()
+    {
+        if (this->deformVBO[0] == 0)
+            return 0;
+        glm::vec3* data = FrameArena::Frame().Alloc<glm::vec3>(this->vertices.size() * 2);
+        glBindBuffer(GL_ARRAY_BUFFER, this->deformVBO[this->current]);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, this->vertices.size() * 2 * sizeof(glm::vec3), data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // the VBO is updated too (only the changed vertices), so the mesh can be rendered again without the ping-pong buffers
+        return this->ApplyFeedback(data);
+    }
+
+    // copy of the mesh for an instance which is going to be deformed (see Model::makeUnique): the vertices (CPU copy, and VBO, copied on the GPU)
+    // belong to the copy, while the indices (EBO) and the textures are shared with this mesh, which must outlive all its copies
+    // (the shared EBO is deleted with this mesh)
+    Mesh Clone() const
+    {
+        Mesh copy(*this);
+        copy.sharedIndices = true;
+        copy.gpuResident = false;
+        copy.current = 0;
+        copy.deformVBO[0] = copy.deformVBO[1] = 0;
+        copy.changed.clear();
+        copy.dirty.clear();
+
+        glGenVertexArrays(1, &copy.VAO);
+        glGenBuffers(1, &copy.VBO);
+        GLsizeiptr size = this->vertices.size() * this->vertexSize();
+        glBindBuffer(GL_COPY_READ_BUFFER, this->VBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, copy.VBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        glBindVertexArray(copy.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, copy.VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, copy.EBO);
+        copy.setupAttributes();
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return copy;
+    }
+
+    // ping-pong buffer with the latest data (0 if not created)
+    GLuint CurrentBuffer() const
+    {
+        return this->deformVBO[this->current];
     }
 
     //////////////////////////////////////////
@@ -164,12 +384,29 @@ public:
     {
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &EBO);
+        // the EBO of a clone belongs to the original mesh
+        if (!this->sharedIndices)
+            glDeleteBuffers(1, &EBO);
+        if (this->deformVBO[0] != 0)
+        {
+            glDeleteVertexArrays(2, this->deformVAO);
+            glDeleteBuffers(2, this->deformVBO);
+        }
     }
 
 private:
   // VBO and EBO
   GLuint VBO, EBO;
+  // if true, the EBO is shared with another mesh (see Clone)
+  bool sharedIndices;
+  // indices of the changed vertices (kept as member to avoid allocations at each impact)
+  vector<GLuint> changed;
+  // indices of the vertices modified since the last call of UpdateMesh (they can be repeated)
+  vector<GLuint> dirty;
+  // ping-pong buffers with interleaved (position, normal) pairs, and the corresponding VAOs (0 if not created)
+  GLuint deformVBO[2], deformVAO[2];
+  // index of the ping-pong buffer with the latest data
+  GLuint current;
 
   //////////////////////////////////////////
   // buffer objects\arrays are initialized
@@ -177,7 +414,7 @@ private:
   // https://learnopengl.com/#!Getting-started/Hello-Triangle
   // (in different parts of the page), or here:
   // http://www.informit.com/articles/article.aspx?p=1377833&seqNum=8
-  void setupMesh()
+  void setupMesh(const Vertex* vertexData, const GLuint* indexData)
   {
       // we create the buffers
       glGenVertexArrays(1, &this->VAO);
@@ -188,28 +425,98 @@ private:
       glBindVertexArray(this->VAO);
       // we copy data in the VBO - we must set the data dimension, and the pointer to the structure cointaining the data
       glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-      glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+      // vertices are modified by the impacts, so we use GL_DYNAMIC_DRAW
+      if (this->packed)
+      {
+          vector<PackedVertex> packedData(this->vertices.size());
+          for (GLuint i = 0; i < packedData.size(); i++)
+              packedData[i] = PackVertex(vertexData[i]);
+          glBufferData(GL_ARRAY_BUFFER, packedData.size() * sizeof(PackedVertex), &packedData[0], GL_DYNAMIC_DRAW);
+      }
+      else
+          glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), vertexData, GL_DYNAMIC_DRAW);
       // we copy data in the EBO - we must set the data dimension, and the pointer to the structure cointaining the data
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), indexData, GL_STATIC_DRAW);
+
+      this->setupAttributes();
+
+      glBindVertexArray(0);
+  }
+
+  // size of a vertex in the VBO
+  GLsizei vertexSize() const
+  {
+      return this->packed ? sizeof(PackedVertex) : sizeof(Vertex);
+  }
 
+  // the pointers to the vertex attributes in the VBO are set in the active VAO
+  void setupAttributes()
+  {
       // we set in the VAO the pointers to the different vertex attributes (with the relative offsets inside the data structure)
       // vertex positions
       glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, this->vertexSize(), (GLvoid*)0);
       // Normals
       glEnableVertexAttribArray(1);
-      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-      // Texture Coordinates
+      if (this->packed)
+          glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Normal));
+      else
+          glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+      this->setupStaticAttributes();
+  }
+
+  // the pointers to texture coordinates, tangents and bitangents (which are not deformed) in the VBO bound to GL_ARRAY_BUFFER are set in the active VAO
+  void setupStaticAttributes()
+  {
       glEnableVertexAttribArray(2);
-      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-      // Tangent
       glEnableVertexAttribArray(3);
-      glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
-      // Bitangent
       glEnableVertexAttribArray(4);
-      glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
+      if (this->packed)
+      {
+          // Texture Coordinates
+          glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, TexCoords));
+          // Tangent
+          glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Tangent));
+          // Bitangent
+          glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Bitangent));
+      }
+      else
+      {
+          // Texture Coordinates
+          glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+          // Tangent
+          glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
+          // Bitangent
+          glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
+      }
+  }
+
+  // creation of the ping-pong buffers. Each VAO reads positions and normals from its ping-pong buffer,
+  // while texture coordinates, tangents, bitangents and indices come from the VBO and EBO of the mesh, which do not change
+  void setupPingPong()
+  {
+      glGenVertexArrays(2, this->deformVAO);
+      glGenBuffers(2, this->deformVBO);
+
+      for (GLuint k = 0; k < 2; k++)
+      {
+          glBindVertexArray(this->deformVAO[k]);
+          // written and read only by the GPU
+          glBindBuffer(GL_ARRAY_BUFFER, this->deformVBO[k]);
+          glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * 2 * sizeof(glm::vec3), NULL, GL_DYNAMIC_COPY);
+          // vertex positions
+          glEnableVertexAttribArray(0);
+          glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (GLvoid*)0);
+          // Normals
+          glEnableVertexAttribArray(1);
+          glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (GLvoid*)sizeof(glm::vec3));
 
+          glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+          glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+          this->setupStaticAttributes();
+      }
       glBindVertexArray(0);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
   }
 };
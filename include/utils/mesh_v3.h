@@ -132,13 +132,15 @@ public:
             GLuint vbo;
             GLuint tbo;
 
-            glm::vec3 data[vertices.size()];
+            // transient buffers are allocated on the heap, and released at the end of the call (a variable-length array on the stack overflows with large meshes)
+            GLuint dataSize = vertices.size() * sizeof(glm::vec3);
+            vector<glm::vec3> data(vertices.size());
             for(int i=0; i<vertices.size(); i++)
                 data[i] = vertices[i].Position;
                 
             glGenBuffers(1, &vbo);
             glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+            glBufferData(GL_ARRAY_BUFFER, dataSize, &data[0], GL_STATIC_DRAW);
 
             GLint inputAttrib = glGetAttribLocation(shader.ID, "inValue");
             glEnableVertexAttribArray(inputAttrib);
@@ -147,15 +149,16 @@ public:
             // Create transform feedback buffer
             glGenBuffers(1, &tbo);
             glBindBuffer(GL_ARRAY_BUFFER, tbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(data), nullptr, GL_STATIC_READ);
+            glBufferData(GL_ARRAY_BUFFER, dataSize, nullptr, GL_STATIC_READ);
 
             // Perform feedback transform
             glEnable(GL_RASTERIZER_DISCARD);
 
             glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tbo);
 
+            // one point for each vertex
             glBeginTransformFeedback(GL_POINTS);
-            glDrawArrays(GL_POINTS, 0, sizeof(data));
+            glDrawArrays(GL_POINTS, 0, vertices.size());
             glEndTransformFeedback();
 
             glDisable(GL_RASTERIZER_DISCARD);
@@ -163,12 +166,12 @@ public:
             glFlush();
 
             // Fetch and print results
-            glm::vec3 feed[sizeof(data)];
-            glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, sizeof(feed), feed);
+            vector<glm::vec3> feed(vertices.size());
+            glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, dataSize, &feed[0]);
 
 //            printf("%f %f %f %f %f %f\n", feed[0].x, feed[0].y, feed[0].z, feed[1].x, feed[1].y, feed[1].z);
 
-            int size = sizeof(data)/sizeof(data[0]);
+            int size = vertices.size();
 
 //            for (int i = 0; i<size; i++)
 //            {
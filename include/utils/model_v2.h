@@ -42,9 +42,46 @@ using namespace std;
 
 // we include the Mesh class (v2), which manages the "OpenGL side" (= creation and allocation of VBO, VAO, EBO buffers) of the loading of models
 #include <utils/mesh_v2.h>
+// binary cache of the imported meshes, and of the decoded textures
+#include <utils/mesh_cache.h>
+#include <utils/texture_cache.h>
+// spatial hash over the vertices, and CPU implementation of the deformation
+#include <utils/spatial_hash.h>
+#include <utils/deformation.h>
+// asynchronous copy of GPU data to the CPU
+#include <utils/async_readback.h>
+// triangle mesh collision shape over the vertices of the meshes
+#include <utils/mesh_collider.h>
 
 // function used to load image data
 GLint TextureFromFile(const char* path, string directory);
+// a 2D texture (with mipmaps) is created from the decoded image (see TextureCache::Load), and the texels are freed
+GLint TextureFromImage(ImageData& image);
+
+// data of a mesh read from file, before the creation of the OpenGL buffers (see Model::Parse).
+// The fields have the same names of the ones of the Mesh class, so the mesh cache can be written from both (see MeshCache::Write)
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+    // type and path of the textures (the ids are assigned by Model::Upload)
+    vector<Texture> textures;
+};
+
+// data of a model read from file: meshes, and the decoded images of their textures (each file once).
+// If the meshes are read from the mesh cache, the cache stays mapped until Upload, which copies the vertex and index arrays directly
+// from the mapped file into the meshes (so the vectors of the MeshData are empty, and only their textures are set)
+struct ModelData {
+    string path;
+    vector<MeshData> meshes;
+    vector<ImageData> images;
+    MeshCache cache;
+};
+
+// post-processing applied by Assimp to the loaded models (they are saved in the mesh cache: if they change, the models are imported again)
+const GLuint MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
+// meshes with at least this number of vertices use the packed layout of the VBO (see PackedVertex in utils/mesh_v2.h): half the memory
+// and the vertex fetch bandwidth of the full layout, with 10 bits normals, tangents and bitangents, and half float texture coordinates
+const GLuint PACKED_VERTEX_MIN_VERTICES = 4096;
 
 
 /////////////////// MODEL class ///////////////////////
@@ -57,19 +94,157 @@ public:
     vector<Mesh> meshes;
     // the folder on disk of the model (needed for the loading of textures, if model is provided of textures)
     string directory;
+    // the file on disk of the model (used to identify the collision shapes built from the model, see Physics::createRigidBody)
+    string path;
     
     int type;
 
+    // spatial hash over the vertices of the meshes (in model coordinates), built after loading and updated when vertices are moved
+    SpatialHash grid;
+    // for each mesh, the indices of the vertices found by the last call of FindImpactVertices
+    vector<vector<GLuint> > impactVertices;
+    // number of requests to an AsyncReadback whose data have not been copied in the meshes yet
+    int pendingReadbacks;
+    // optional collision shape built on the vertices of the meshes (see EnableCollider). Its BVH is refit after each deformation
+    MeshCollider* collider;
+
     //////////////////////////////////////////
     
     // default constructor
-    Model() { }
+    Model() { this->pendingReadbacks = 0; this->collider = NULL; this->asset = NULL; this->gpuResident = false; this->resetTouched(); }
     
     // constructor
     Model(const string& path, int type = 0)
     {
         this->loadModel(path);
         this->type = type;
+        this->pendingReadbacks = 0;
+        this->collider = NULL;
+        this->asset = NULL;
+        this->gpuResident = false;
+        this->resetTouched();
+    }
+
+    // constructor of an instance of a shared model (e.g., loaded once by an AssetRegistry, see utils/asset_registry.h).
+    // The instance uses meshes (CPU data and GPU buffers) and spatial hash of the asset, and gets its own copy of the vertices
+    // only when it is deformed for the first time: memory and loading time depend on the number of different models, and on the number of deformed instances.
+    // The asset must not be deleted before its instances
+    Model(Model* asset, int type = 0)
+    {
+        this->asset = asset;
+        this->path = asset->path;
+        this->directory = asset->directory;
+        this->type = type;
+        this->pendingReadbacks = 0;
+        this->collider = NULL;
+        this->gpuResident = false;
+        this->resetTouched();
+    }
+
+    // meshes used for rendering and collisions: the ones of the asset, until the instance gets its own copy
+    vector<Mesh>& Meshes()
+    {
+        return this->asset ? this->asset->meshes : this->meshes;
+    }
+
+    // true if the model is an instance which still shares the meshes of its asset
+    bool IsShared() const
+    {
+        return this->asset != NULL;
+    }
+
+    // true if positions and normals are kept on the GPU (see SetGpuResident)
+    bool GpuResident() const
+    {
+        return this->gpuResident;
+    }
+
+    //////////////////////////////////////////
+
+    // the model file is read (from the mesh cache, or imported with Assimp) and the images of its textures are decoded, without OpenGL calls:
+    // it can be called by a worker thread (see utils/asset_loader.h), and the data are then sent to the GPU by Upload
+    static void Parse(const string& path, ModelData& data)
+    {
+        data.path = path;
+        string directory = path.substr(0, path.find_last_of('/'));
+
+        if (data.cache.Open(path, MODEL_IMPORT_FLAGS))
+            Model::readCache(data);
+        else
+        {
+            Model::importModel(path, data);
+            if (!data.meshes.empty())
+                MeshCache::Write(path, MODEL_IMPORT_FLAGS, data.meshes);
+        }
+
+        // each texture file is decoded once
+        for (GLuint i = 0; i < data.meshes.size(); i++)
+        {
+            for (GLuint j = 0; j < data.meshes[i].textures.size(); j++)
+            {
+                string file = data.meshes[i].textures[j].path.C_Str();
+                bool found = false;
+                for (GLuint k = 0; k < data.images.size() && !found; k++)
+                    found = data.images[k].Path == file;
+                if (found)
+                    continue;
+                ImageData image;
+                TextureCache::Load(directory + '/' + file, image);
+                image.Path = file;
+                data.images.push_back(image);
+            }
+        }
+    }
+
+    // the OpenGL buffers of the meshes and the textures are created from the parsed data (it must be called by the thread which owns the GL context),
+    // and the spatial hash is built. The decoded images are freed, and the mesh cache is unmapped
+    void Upload(ModelData& data)
+    {
+        // we get the file and the folder on disk of the model
+        this->path = data.path;
+        this->directory = data.path.substr(0, data.path.find_last_of('/'));
+
+        for (GLuint i = 0; i < data.images.size(); i++)
+        {
+            Texture texture;
+            texture.id = TextureFromImage(data.images[i]);
+            texture.path = aiString(data.images[i].Path);
+            this->textures_loaded.push_back(texture);
+        }
+        data.images.clear();
+
+        this->meshes.reserve(data.meshes.size());
+        for (GLuint i = 0; i < data.meshes.size(); i++)
+        {
+            MeshData& mesh = data.meshes[i];
+            for (GLuint j = 0; j < mesh.textures.size(); j++)
+            {
+                for (GLuint k = 0; k < this->textures_loaded.size(); k++)
+                {
+                    if (this->textures_loaded[k].path == mesh.textures[j].path)
+                    {
+                        mesh.textures[j].id = this->textures_loaded[k].id;
+                        this->textures_loaded[k].type = mesh.textures[j].type;
+                    }
+                }
+            }
+            // vertex and index arrays: in the mapped cache, or imported with Assimp
+            bool cached = data.cache.IsOpen();
+            GLuint numVertices = cached ? data.cache.Entry(i).NumVertices : mesh.vertices.size();
+            GLuint numIndices = cached ? data.cache.Entry(i).NumIndices : mesh.indices.size();
+            // meshes without triangles are skipped (like in MeshCollider), so every Mesh has vertex and index arrays
+            if (numVertices == 0 || numIndices == 0)
+                continue;
+            const Vertex* vertices = cached ? data.cache.Vertices(i) : &mesh.vertices[0];
+            const GLuint* indices = cached ? data.cache.Indices(i) : &mesh.indices[0];
+            bool packed = numVertices >= PACKED_VERTEX_MIN_VERTICES;
+            this->meshes.push_back(Mesh(vertices, numVertices, indices, numIndices, mesh.textures, packed));
+        }
+        data.meshes.clear();
+        data.cache.Close();
+
+        // we build the spatial hash over the loaded vertices
+        this->grid.Build(this->meshes);
     }
 
     //////////////////////////////////////////
@@ -78,8 +253,9 @@ public:
     // In this case, we pass also the Shader class instance, because it will be used for the textures
     void Draw(Shader shader)
     {
-        for(GLuint i = 0; i < this->meshes.size(); i++)
-            this->meshes[i].Draw(shader);
+        vector<Mesh>& meshes = this->Meshes();
+        for(GLuint i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(shader);
     }
 
     //////////////////////////////////////////
@@ -89,54 +265,277 @@ public:
     {
         for(GLuint i = 0; i < this->meshes.size(); i++)
             this->meshes[i].Delete();
+        if (this->collider)
+        {
+            this->collider->Delete();
+            delete this->collider;
+        }
     }
     
+    // positions and normals captured by transform feedback (interleaved (position, normal) pairs, for all the vertices of all the meshes)
+    // are copied in the meshes
     void UpdateData(glm::vec3 data[])
     {
+        this->makeUnique();
+        int cnt = 0;
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            meshes[i].ApplyFeedback(&data[cnt]);
+            this->updateGrid(i);
+            cnt += meshes[i].vertices.size()*2;
+        }
+        this->refitCollider();
+    }
+
+    // finds the vertices that can be moved by an impact in hitPoint, with the given range (both in world coordinates).
+    // Results are stored in impactVertices. It returns the total number of vertices found
+    int FindImpactVertices(const glm::mat4& model, const glm::vec3& hitPoint, float range)
+    {
+        glm::vec3 center = glm::vec3(glm::inverse(model) * glm::vec4(hitPoint, 1.0f));
+        // the smallest scale of the model matrix gives the largest radius in model coordinates (+1% to be conservative with rounding errors)
+        float scale = glm::min(glm::min(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1]))), glm::length(glm::vec3(model[2])));
+        SpatialHash& grid = this->asset ? this->asset->grid : this->grid;
+        return grid.Query(this->Meshes(), center, range / scale * 1.01f, this->impactVertices);
+    }
+
+    // positions and normals captured by transform feedback for the vertices found by FindImpactVertices
+    // (interleaved (position, normal) pairs, in the same order of impactVertices) are copied in the meshes
+    void UpdateImpactVertices(const glm::vec3* data)
+    {
+        this->UpdateImpactVertices(this->impactVertices, data);
+    }
+
+    // same as above, with the vertices given by a (previous) result of FindImpactVertices
+    void UpdateImpactVertices(const vector<vector<GLuint> >& indices, const glm::vec3* data)
+    {
+        this->makeUnique();
         int cnt = 0;
-        for (int i = 0; i<meshes.size(); i++)
+        for (GLuint i = 0; i < indices.size(); i++)
+        {
+            for (GLuint k = 0; k < indices[i].size(); k++, cnt += 2)
+            {
+                GLuint j = indices[i][k];
+                if (meshes[i].streams.Position(j) == data[cnt])
+                    continue;
+                meshes[i].streams.Set(j, data[cnt], data[cnt + 1]);
+                meshes[i].streams.Store(meshes[i].vertices, j);
+                meshes[i].MarkDirty(j);
+                this->moveVertex(i, j, data[cnt]);
+            }
+            meshes[i].UpdateMesh();
+        }
+        this->refitCollider();
+    }
+
+    // deformation on the CPU (see utils/deformation.h): only the vertices found by FindImpactVertices are processed.
+    // It returns the number of moved vertices
+    int Deform(DeformationEngine& engine, const glm::mat4& model, const Impact& impact)
+    {
+        int moved = 0;
+        if (this->FindImpactVertices(model, impact.Point, engine.range) == 0)
+            return 0;
+        this->makeUnique();
+        for (GLuint i = 0; i < this->meshes.size(); i++)
+        {
+            int n = engine.Deform(this->meshes[i], this->impactVertices[i], model, impact);
+            for (int k = 0; k < n; k++)
+            {
+                GLuint j = engine.Moved()[k];
+                this->moveVertex(i, j, this->meshes[i].streams.Position(j));
+            }
+            // only the moved vertices are sent to the GPU
+            this->meshes[i].UpdateMesh();
+            moved += n;
+        }
+        this->refitCollider();
+        return moved;
+    }
+
+
+    // positions and normals of all the meshes are moved between CPU and GPU (see Mesh::SetGpuResident)
+    void SetGpuResident(bool resident)
+    {
+        this->gpuResident = resident;
+        // a shared instance is rendered with the buffers of the asset: its meshes are moved to the GPU when it gets its own copy
+        if (this->asset)
+            return;
+        for (GLuint i = 0; i < this->meshes.size(); i++)
+        {
+            bool wasResident = this->meshes[i].gpuResident;
+            this->meshes[i].SetGpuResident(resident);
+            if (wasResident && !resident)
+                this->updateGrid(i);
+        }
+        this->refitCollider();
+    }
+
+    // deformation of all the meshes with transform feedback, without reading data back from the GPU (see Mesh::DeformOnGpu).
+    // The feedback shader must be active, with its uniforms already set
+    void DeformOnGpu()
+    {
+        this->makeUnique();
+        for (GLuint i = 0; i < this->meshes.size(); i++)
+            this->meshes[i].DeformOnGpu();
+    }
+
+    // the data on the GPU of the meshes kept on the GPU (see SetGpuResident) are read asynchronously, and the CPU copy (and the spatial hash)
+    // is updated when they are available, so the collider of the model can be refitted. Without a collider, the CPU copy is not needed
+    // while the meshes are on the GPU (it is read again by SetGpuResident(false)), and nothing is requested
+    void RequestReadBack(AsyncReadback& readback)
+    {
+        if (this->collider == NULL)
+            return;
+        for (GLuint i = 0; i < this->meshes.size(); i++)
         {
-            for (int j = 0; j<meshes[i].vertices.size(); j++)
+            if (!this->meshes[i].gpuResident)
+                continue;
+            this->pendingReadbacks++;
+            readback.Request(this->meshes[i].CurrentBuffer(), 0, this->meshes[i].vertices.size() * 2 * sizeof(glm::vec3), [this, i](const void* data, GLsizeiptr size)
             {
-                if (meshes[i].vertices[j].Position.x != data[cnt].x || 
-                    meshes[i].vertices[j].Position.y != data[cnt].y ||
-                    meshes[i].vertices[j].Position.z != data[cnt].z)
+                // without data, the CPU copy is left as it is (it is updated by the next readback)
+                if (data != NULL)
                 {
-//                    printf("PRE-NORM: %f %f %f\n", meshes[i].vertices[j].Position.x, meshes[i].vertices[j].Position.y, meshes[i].vertices[j].Position.z);
-//                    printf("NORM: %f %f %f\n", data[cnt].x, data[cnt].y, data[cnt].z);
-                    meshes[i].vertices[j].Position = data[cnt];
-                    cnt += 1;
-//                    printf("PRE-NORM: %f %f %f\n", meshes[i].vertices[j].Normal.x, meshes[i].vertices[j].Normal.y, meshes[i].vertices[j].Normal.z);
-//                    printf("NORM: %f %f %f\n", data[cnt].x, data[cnt].y, data[cnt].z);
-                    meshes[i].vertices[j].Normal = data[cnt];
-                    cnt += 1;
+                    this->meshes[i].ApplyFeedback((const glm::vec3*)data);
+                    this->updateGrid(i);
+                    this->refitCollider();
                 }
-                else
-                    cnt += 2;
-//                printf("VERT: %f %f %f\n", data[cnt].x, data[cnt].y, data[cnt].z);
-  
-//                printf("PRE-NORM: %f %f %f\n", meshes[i].vertices[j].Normal.x, meshes[i].vertices[j].Normal.y, meshes[i].vertices[j].Normal.z);
-//                printf("NORM: %f %f %f\n", data[cnt].x, data[cnt].y, data[cnt].z);
+                this->pendingReadbacks--;
+            });
+        }
+    }
 
-            }
-            meshes[i].UpdateMesh();
+    // the CPU copy of all the meshes (and the spatial hash) is updated with the data on the GPU.
+    // It returns the number of changed vertices
+    int ReadBack()
+    {
+        int changed = 0;
+        for (GLuint i = 0; i < this->meshes.size(); i++)
+        {
+            changed += this->meshes[i].ReadBack();
+            this->updateGrid(i);
         }
+        this->refitCollider();
+        return changed;
+    }
+
+
+    // a triangle mesh collision shape is built on the vertices of the meshes (scale = scale of the model matrix used for rendering).
+    // The shape is returned, to be used for the rigid body of the model (see Physics::createRigidBody)
+    btCollisionShape* EnableCollider(const glm::vec3& scale)
+    {
+        if (this->collider == NULL)
+            this->collider = new MeshCollider(this->Meshes(), scale);
+        return this->collider->shape;
     }
 
 
 private:
+    // box (in model coordinates) containing the previous and the new positions of the vertices moved since the last refit of the collider
+    glm::vec3 touchedMin, touchedMax;
+    // shared model whose meshes are used by this instance (NULL if the model has its own meshes)
+    Model* asset;
+    // positions and normals are kept on the GPU (applied to the meshes of a shared instance when it gets its own copy)
+    bool gpuResident;
+
+    //////////////////////////////////////////
+    // copy on write: before the first deformation, an instance copies the meshes (only vertices: indices and textures stay shared, see Mesh::Clone)
+    // and the spatial hash of its asset, and its collider is moved to the new vertices
+    void makeUnique()
+    {
+        if (this->asset == NULL)
+            return;
+        this->meshes.reserve(this->asset->meshes.size());
+        for (GLuint i = 0; i < this->asset->meshes.size(); i++)
+            this->meshes.push_back(this->asset->meshes[i].Clone());
+        this->grid = this->asset->grid;
+        if (this->collider)
+            this->collider->Rebind(this->meshes);
+        this->asset = NULL;
+        if (this->gpuResident)
+        {
+            for (GLuint i = 0; i < this->meshes.size(); i++)
+                this->meshes[i].SetGpuResident(true);
+        }
+    }
+
+    //////////////////////////////////////////
+    // the vertices of the i-th mesh changed by the last call of Mesh::ApplyFeedback are moved in the spatial hash
+    void updateGrid(GLuint i)
+    {
+        for (GLuint k = 0; k < this->meshes[i].Changed().size(); k++)
+        {
+            GLuint j = this->meshes[i].Changed()[k];
+            this->moveVertex(i, j, this->meshes[i].streams.Position(j));
+        }
+    }
+
+    // the j-th vertex of the i-th mesh is moved in the spatial hash. If the model has a collider, the old cell of the vertex
+    // (which contains its previous position) and the new position are added to the box to refit
+    void moveVertex(GLuint i, GLuint j, const glm::vec3& position)
+    {
+        if (this->collider)
+        {
+            glm::vec3 cellMin, cellMax;
+            this->grid.CellBounds(i, j, cellMin, cellMax);
+            this->touchedMin = glm::min(glm::min(this->touchedMin, cellMin), position);
+            this->touchedMax = glm::max(glm::max(this->touchedMax, cellMax), position);
+        }
+        this->grid.Update(i, j, position);
+    }
+
+    // only the BVH nodes overlapping the touched box are refit
+    void refitCollider()
+    {
+        if (this->collider == NULL || this->touchedMin.x > this->touchedMax.x)
+            return;
+        this->collider->Refit(this->touchedMin, this->touchedMax);
+        this->resetTouched();
+    }
+
+    void resetTouched()
+    {
+        this->touchedMin = glm::vec3(1e30f);
+        this->touchedMax = glm::vec3(-1e30f);
+    }
 
     //////////////////////////////////////////
-    // loading of the model using Assimp library. Nodes are processed to build a vector of Mesh class instances
+    // loading of the model: the file is parsed, and then uploaded to the GPU (the two steps can run on different threads, see utils/asset_loader.h)
     void loadModel(string path)
+    {
+        ModelData data;
+        Model::Parse(path, data);
+        this->Upload(data);
+    }
+
+    // the textures of the meshes are read from the mapped cache of the model (the vertex and index arrays are read by Upload)
+    static void readCache(ModelData& data)
+    {
+        const MeshCache& cache = data.cache;
+        data.meshes.resize(cache.NumMeshes());
+        for (GLuint i = 0; i < cache.NumMeshes(); i++)
+        {
+            const MeshCacheEntry& entry = cache.Entry(i);
+            MeshData& mesh = data.meshes[i];
+            for (GLuint j = 0; j < entry.NumTextures; j++)
+            {
+                const MeshCacheTexture& t = cache.MeshTexture(i, j);
+                mesh.textures.push_back(Model::textureInfo(aiString(string(t.Path)), t.Type));
+            }
+        }
+    }
+
+    // import of the model with Assimp. After the first import, the meshes are saved in a binary cache (see utils/mesh_cache.h),
+    // which is used in the following runs instead of Assimp
+    static void importModel(const string& path, ModelData& data)
     {
         // loading using Assimp
         // N.B.: it is possible to set, if needed, some operations to be performed by Assimp after the loading.
         // Details on the different flags to use are available at: http://assimp.sourceforge.net/lib_html/postprocess_8h.html#a64795260b95f5a4b3f3dc1be4f52e410
         // VERY IMPORTANT: calculation of Tangents and Bitangents is possible only if the model has Texture Coordinates
         // If they are not present, the calculation is skipped (but no error is provided in the foillowing checks!)
+        // N.B.) each call uses its own Importer, so different models can be imported at the same time by different threads
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
         // check for errors (see comment above)
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
@@ -145,17 +544,14 @@ private:
             return;
         }
 
-        // we get the folder on disk of the model
-        this->directory = path.substr(0, path.find_last_of('/'));
-
         // we start the recursive processing of nodes in the Assimp data structure
-        this->processNode(scene->mRootNode, scene);
+        Model::processNode(scene->mRootNode, scene, data);
     }
 
     //////////////////////////////////////////
 
     // Recursive processing of nodes of Assimp data structure
-    void processNode(aiNode* node, const aiScene* scene)
+    static void processNode(aiNode* node, const aiScene* scene, ModelData& data)
     {
         // we process each mesh inside the current node
         for(GLuint i = 0; i < node->mNumMeshes; i++)
@@ -164,29 +560,29 @@ private:
             // "Scene" contains all the data. Class node is used only to point to one or more mesh inside the scene and to maintain informations on relations between nodes
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
             // we start processing of the Assimp mesh using processMesh method.
-            // the result (an istance of the Mesh class) is added to the vector
-            this->meshes.push_back(this->processMesh(mesh, scene));
+            // the result is added to the vector (the OpenGL buffers are created later, by Upload)
+            data.meshes.push_back(MeshData());
+            Model::processMesh(mesh, scene, data.meshes.back());
         }
         // we then recursively process each of the children nodes
         for(GLuint i = 0; i < node->mNumChildren; i++)
         {
-            this->processNode(node->mChildren[i], scene);
+            Model::processNode(node->mChildren[i], scene, data);
         }
 
     }
 
     //////////////////////////////////////////
 
-    // Processing of the Assimp mesh in order to obtain an "OpenGL mesh"
-    // = we create and allocate the buffers used to send mesh data to the GPU
-    // In this case, we pass also aiScene instance, because we need to set the materials once loaded the textures 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // Processing of the Assimp mesh in order to obtain the data of an "OpenGL mesh"
+    // = vertices, indices and textures which will be used to create and allocate the buffers used to send mesh data to the GPU
+    // In this case, we pass also aiScene instance, because we need the materials of the mesh
+    static void processMesh(aiMesh* mesh, const aiScene* scene, MeshData& data)
     {
-      // data structures for vertices and indices of vertices (for faces)
-        vector<Vertex> vertices;
-        vector<GLuint> indices;
-        // vector with all the model textures
-        vector<Texture> textures;
+        // data structures for vertices and indices of vertices (for faces)
+        vector<Vertex>& vertices = data.vertices;
+        vector<GLuint>& indices = data.indices;
+        vertices.reserve(mesh->mNumVertices);
 
         for(GLuint i = 0; i < mesh->mNumVertices; i++)
         {
@@ -254,75 +650,68 @@ private:
             // Normal: texture_normalN
 
             // 1. Diffuse maps
-            vector<Texture> diffuseMaps = this->loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-            textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+            Model::materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
             // 2. Specular maps
-            vector<Texture> specularMaps = this->loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-            textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+            Model::materialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
             // 3. Normal maps
-            std::vector<Texture> normalMaps = this->loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-            textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+            Model::materialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
             // 4. Height maps
-            std::vector<Texture> heightMaps = this->loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-            textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+            Model::materialTextures(material, aiTextureType_AMBIENT, "texture_height", data.textures);
         }
-
-        // we return an instance of the Mesh class created using the vertices and faces data structures we have created above.
-        return Mesh(vertices, indices, textures);
     }
 
-    // Load (if not yet loaded) the textures defined in the model materials (if defined)
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // the textures defined in the model materials (if defined) are added to the list (the images are decoded by Parse)
+    static void materialTextures(aiMaterial* mat, aiTextureType type, const string& typeName, vector<Texture>& textures)
     {
-        vector<Texture> textures;
         for(GLuint i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // if texture has been already loaded, jump to the next one
-            GLboolean skip = false;
-            for(GLuint j = 0; j < textures_loaded.size(); j++)
-            {
-                if(textures_loaded[j].path == str)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // If texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str;
-                textures.push_back(texture);
-                this->textures_loaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-            }
+            textures.push_back(Model::textureInfo(str, typeName));
         }
-        return textures;
+    }
+
+    // texture of a mesh, before its upload (the id is assigned by Upload)
+    static Texture textureInfo(const aiString& str, const string& typeName)
+    {
+        Texture texture;
+        texture.id = 0;
+        texture.type = typeName;
+        texture.path = str;
+        return texture;
     }
 };
 
 // we load texture from disk, and we create OpenGL Texture Unit
 GLint TextureFromFile(const char* path, string directory)
 {
-     //Generate texture ID and load texture data
-    string filename = string(path);
-    filename = directory + '/' + filename;
+    ImageData image;
+    TextureCache::Load(directory + '/' + string(path), image);
+    return TextureFromImage(image);
+}
+
+GLint TextureFromImage(ImageData& image)
+{
+    //Generate texture ID
     GLuint textureID;
     glGenTextures(1, &textureID);
-    int width,height,channels;
-    unsigned char* image = stbi_load(filename.c_str(), &width, &height, &channels, STBI_rgb);
 
     // Assign texture to ID
     glBindTexture(GL_TEXTURE_2D, textureID);
-    // 3 channels = RGB ; 4 channel = RGBA
-    if (channels==3)
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-    else if (channels==4)
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // 1 channel = RED ; 2 channels = RG ; 3 channels = RGB ; 4 channel = RGBA
+    GLenum format = image.Channels == 1 ? GL_RED : (image.Channels == 2 ? GL_RG : (image.Channels == 4 ? GL_RGBA : GL_RGB));
+    // the rows of the levels are tightly packed
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (GLuint i = 0; i < image.Levels.size(); i++)
+        glTexImage2D(GL_TEXTURE_2D, i, format, max(image.Width >> i, 1), max(image.Height >> i, 1), 0, format, GL_UNSIGNED_BYTE, &image.Levels[i][0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    // the mipmaps are computed by the driver only if they are not in the image (see TextureCache::BuildMipmaps)
+    if (image.Levels.size() == 1)
+        glGenerateMipmap(GL_TEXTURE_2D);
+    else if (image.Levels.size() > 1)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.Levels.size() - 1);
 
     // we set how to consider UVs outside [0,1] range
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
@@ -332,6 +721,6 @@ GLint TextureFromFile(const char* path, string directory)
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glBindTexture(GL_TEXTURE_2D, 0);
     // we free the memory once we have created an OpenGL texture
-    stbi_image_free(image);
+    image.Levels.clear();
     return textureID;
 }
@@ -1,49 +1,309 @@
 #pragma once
 
 #include <bullet/btBulletDynamicsCommon.h>
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <bullet/BulletDynamics/Dynamics/btSimulationIslandManagerMt.h>
+#include <bullet/BulletCollision/CollisionShapes/btShapeHull.h>
 //#include <bullet/btBulletWorldImporter.h>
 #include <vector>
+#include <string>
+#include <iostream>
+
+#include <utils/thread_pool.h>
+#include <utils/shape_cache.h>
+#include <utils/world_snapshot.h>
 
 enum shapes{BOX,SPHERE,TRIANGLE_MESH,CONVEX_HULL};
 
+// collision filter groups added to the ones of Bullet (btBroadphaseProxy::CollisionFilterGroups): deformable objects collide only with projectiles,
+// and only the contacts between the two groups are impacts (see ImpactQueue::Listen)
+enum collisionGroups{DEFORMABLE_GROUP = 64, PROJECTILE_GROUP = 128};
+
+// constraint solver used by the multithreaded world: islands are solved in parallel, so each thread needs its own btSequentialImpulseConstraintSolver
+// (the solver keeps temporary data in its members). A free solver is taken with an atomic operation, because the prebuilt Bullet libraries
+// are compiled without BT_THREADSAFE (btSpinMutex does nothing)
+class SolverPool : public btConstraintSolver
+{
+public:
+    SolverPool(int numSolvers)
+    {
+        this->solvers.resize(numSolvers);
+        this->busy.resize(numSolvers, 0);
+        for (int i = 0; i < numSolvers; i++)
+            this->solvers[i] = new btSequentialImpulseConstraintSolver();
+    }
+    
+    virtual ~SolverPool()
+    {
+        for (GLuint i = 0; i < this->solvers.size(); i++)
+            delete this->solvers[i];
+    }
+    
+    virtual btScalar solveGroup(btCollisionObject** bodies, int numBodies, btPersistentManifold** manifolds, int numManifolds, btTypedConstraint** constraints, int numConstraints,
+                                const btContactSolverInfo& info, btIDebugDraw* debugDrawer, btDispatcher* dispatcher)
+    {
+        // there is a solver for each thread, so a free one is always found
+        int i = 0;
+        while (!__sync_bool_compare_and_swap(&this->busy[i], 0, 1))
+            i = (i + 1) % this->solvers.size();
+        btScalar result = this->solvers[i]->solveGroup(bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, info, debugDrawer, dispatcher);
+        __sync_lock_release(&this->busy[i]);
+        return result;
+    }
+    
+    virtual void reset()
+    {
+        for (GLuint i = 0; i < this->solvers.size(); i++)
+            this->solvers[i]->reset();
+    }
+    
+    virtual btConstraintSolverType getSolverType() const
+    {
+        return BT_SEQUENTIAL_IMPULSE_SOLVER;
+    }
+    
+private:
+    vector<btSequentialImpulseConstraintSolver*> solvers;
+    vector<int> busy;
+};
+
+// pool of projectiles (dynamic spheres): bodies and motion states are allocated once and reused, and all of them share the same btSphereShape.
+// A projectile is retired (removed from the world, and put back in the pool) after a given lifetime, or when it falls asleep;
+// if all the projectiles are in use, the oldest one is reused. So the number of collision objects in the world is bounded
+class ProjectilePool
+{
+public:
+    ProjectilePool(btDiscreteDynamicsWorld* world, float radius, float mass, float friction, float restitution, double lifetime, int maxProjectiles,
+                   double timeStep = 1.0 / 60.0)
+    {
+        this->world = world;
+        this->shape = new btSphereShape(radius);
+        this->radius = radius;
+        this->timeStep = timeStep;
+        this->mass = mass;
+        this->friction = friction;
+        this->restitution = restitution;
+        this->lifetime = lifetime;
+        this->maxProjectiles = maxProjectiles;
+        this->shape->calculateLocalInertia(mass, this->localInertia);
+    }
+    
+    ~ProjectilePool()
+    {
+        for (GLuint i = 0; i < this->active.size(); i++)
+            this->world->removeRigidBody(this->active[i]);
+        for (GLuint i = 0; i < this->bodies.size(); i++)
+        {
+            delete this->bodies[i]->getMotionState();
+            delete this->bodies[i];
+        }
+        delete this->shape;
+    }
+    
+    // a projectile is placed in pos, and launched with the given impulse
+    btRigidBody* Fire(glm::vec3 pos, glm::vec3 impulse, double time)
+    {
+        btRigidBody* body;
+        if (!this->available.empty())
+        {
+            body = this->available.back();
+            this->available.pop_back();
+        }
+        else if ((int)this->bodies.size() < this->maxProjectiles)
+            body = this->allocate();
+        else
+        {
+            // all the projectiles are in use: the oldest one is reused
+            body = this->active[0];
+            this->retire(0);
+            this->available.pop_back();
+        }
+        
+        btTransform objTransform;
+        objTransform.setIdentity();
+        objTransform.setOrigin(btVector3(pos.x, pos.y, pos.z));
+        body->setWorldTransform(objTransform);
+        body->setInterpolationWorldTransform(objTransform);
+        body->getMotionState()->setWorldTransform(objTransform);
+        body->setLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+        body->setAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+        body->setInterpolationLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+        body->setInterpolationAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+        body->clearForces();
+        body->forceActivationState(ACTIVE_TAG);
+        body->setDeactivationTime(0.0f);
+        
+        this->world->addRigidBody(body, PROJECTILE_GROUP | btBroadphaseProxy::DefaultFilter, btBroadphaseProxy::AllFilter);
+        body->applyCentralImpulse(btVector3(impulse.x, impulse.y, impulse.z));
+        this->updateCcd(body);
+        
+        this->active.push_back(body);
+        this->fireTime.push_back(time);
+        return body;
+    }
+    
+    // projectiles older than the lifetime, or sleeping, are removed from the world, and CCD is updated for the others (their speed changes
+    // with gravity and bounces). It returns the number of retired projectiles
+    int Update(double time)
+    {
+        int retired = 0;
+        for (int i = this->active.size() - 1; i >= 0; i--)
+        {
+            if (time - this->fireTime[i] > this->lifetime || !this->active[i]->isActive())
+            {
+                this->retire(i);
+                retired++;
+            }
+            else
+                this->updateCcd(this->active[i]);
+        }
+        return retired;
+    }
+    
+    // all the projectiles are removed from the world (e.g., when a snapshot of the scene is restored)
+    void RetireAll()
+    {
+        for (int i = this->active.size() - 1; i >= 0; i--)
+            this->retire(i);
+    }
+    
+    // projectiles currently in the world (from the oldest to the newest)
+    const vector<btRigidBody*>& Active() const
+    {
+        return this->active;
+    }
+    
+private:
+    btDiscreteDynamicsWorld* world;
+    btSphereShape* shape;
+    btVector3 localInertia;
+    float radius, mass, friction, restitution;
+    double lifetime;
+    // time step of the simulation, used to decide if a projectile needs CCD
+    double timeStep;
+    int maxProjectiles;
+    // all the allocated bodies, bodies in the world (with their firing time), bodies ready to be reused
+    vector<btRigidBody*> bodies;
+    vector<btRigidBody*> active;
+    vector<double> fireTime;
+    vector<btRigidBody*> available;
+    
+    // copy is not allowed (the bodies would be deallocated twice)
+    ProjectilePool(const ProjectilePool&);
+    ProjectilePool& operator=(const ProjectilePool&);
+    
+    btRigidBody* allocate()
+    {
+        btTransform objTransform;
+        objTransform.setIdentity();
+        btDefaultMotionState* motionState = new btDefaultMotionState(objTransform);
+        
+        btRigidBody::btRigidBodyConstructionInfo rbInfo(this->mass, motionState, this->shape, this->localInertia);
+        rbInfo.m_friction = this->friction;
+        rbInfo.m_restitution = this->restitution;
+        rbInfo.m_angularDamping = 0.3f;
+        rbInfo.m_rollingFriction = 0.3f;
+        
+        btRigidBody* body = new btRigidBody(rbInfo);
+        this->bodies.push_back(body);
+        return body;
+    }
+    
+    // continuous collision detection: a projectile moving more than its radius in a step could pass through thin objects (e.g., the triangle meshes
+    // of the deformable models) without any contact, so its motion is swept against the world, and it is stopped at the first hit.
+    // The swept sphere is smaller than the projectile, so at the clamped position the projectile touches the hit object, and the contact is found
+    // by the narrow phase of the next step (and recorded by ImpactQueue like the other contacts). Slow projectiles do not pay for the sweep
+    void updateCcd(btRigidBody* body)
+    {
+        btScalar motion = body->getLinearVelocity().length() * this->timeStep;
+        if (motion > this->radius)
+        {
+            body->setCcdMotionThreshold(this->radius);
+            body->setCcdSweptSphereRadius(0.8f * this->radius);
+        }
+        else
+            body->setCcdMotionThreshold(0.0f);
+    }
+    
+    // the i-th active projectile is removed from the world, and put back in the pool (the order of the active projectiles is kept)
+    void retire(int i)
+    {
+        this->world->removeRigidBody(this->active[i]);
+        this->available.push_back(this->active[i]);
+        this->active.erase(this->active.begin() + i);
+        this->fireTime.erase(this->fireTime.begin() + i);
+    }
+};
+
 class Physics
 {
 public:
     btDiscreteDynamicsWorld* dynamicsWorld;
+    // shapes created outside the class (see the last createRigidBody)
     btAlignedObjectArray<btCollisionShape*> collisionShapes;
+    // boxes, spheres and convex hulls, shared by the bodies with the same dimensions (or built from the same meshes)
+    ShapeCache shapeCache;
     btDefaultCollisionConfiguration* collisionConfiguration;
     btCollisionDispatcher* dispatcher;
     btBroadphaseInterface* overlappingPairCache;
-    btSequentialImpulseConstraintSolver* solver;
+    btConstraintSolver* solver;
+    // threads used to solve the simulation islands (NULL for the single-threaded world)
+    ThreadPool* threadPool;
+    // reusable projectiles (NULL until CreateProjectilePool is called)
+    ProjectilePool* projectiles;
     
-    Physics()
+    // numThreads > 1: the islands of the simulation are solved in parallel by numThreads threads (btDiscreteDynamicsWorldMt),
+    // otherwise a single-threaded btDiscreteDynamicsWorld is used
+    Physics(int numThreads = 1)
     {
         this->collisionConfiguration = new btDefaultCollisionConfiguration();
         this->dispatcher = new btCollisionDispatcher(this->collisionConfiguration);
         this->overlappingPairCache = new btDbvtBroadphase();
-        this->solver = new btSequentialImpulseConstraintSolver();
+        this->projectiles = NULL;
         
-        this->dynamicsWorld = new btDiscreteDynamicsWorld(this->dispatcher, this->overlappingPairCache, this->solver, this->collisionConfiguration);
+        if (numThreads > 1)
+        {
+            this->threadPool = new ThreadPool(numThreads);
+            this->solver = new SolverPool(numThreads);
+            this->dynamicsWorld = new btDiscreteDynamicsWorldMt(this->dispatcher, this->overlappingPairCache, this->solver, this->collisionConfiguration);
+            
+            // the world creates its btSimulationIslandManagerMt, which calls our function to dispatch the islands to the threads
+            Physics::islandPool() = this->threadPool;
+            btSimulationIslandManagerMt* islandManager = (btSimulationIslandManagerMt*)this->dynamicsWorld->getSimulationIslandManager();
+            islandManager->setIslandDispatchFunction(Physics::parallelIslandDispatch);
+        }
+        else
+        {
+            this->threadPool = NULL;
+            this->solver = new btSequentialImpulseConstraintSolver();
+            this->dynamicsWorld = new btDiscreteDynamicsWorld(this->dispatcher, this->overlappingPairCache, this->solver, this->collisionConfiguration);
+        }
         this->dynamicsWorld->setGravity(btVector3(0.0f, -9.82f, 0.0f));
     }
     
-    btRigidBody* createRigidBody(int type, glm::vec3 pos, glm::vec3 size, glm::vec3 rot, float m, float friction, float restitution)
+    // if group != 0, the body is added to the world with the given collision filter group and mask (otherwise, with the default ones of Bullet)
+    btRigidBody* createRigidBody(int type, glm::vec3 pos, glm::vec3 size, glm::vec3 rot, float m, float friction, float restitution, int group = 0, int mask = 0)
     {
-        btCollisionShape* cShape = NULL;
-        
         btVector3 position = btVector3(pos.x, pos.y, pos.z);
         btQuaternion rotation;
         rotation.setEuler(rot.x, rot.y, rot.z);
         
-        if (type == BOX)
+        // the shape is created only if there is not already a shape with the same type and dimensions
+        ShapeKey key;
+        key.Type = type;
+        key.Size = (type == SPHERE) ? glm::vec3(size.x, 0.0f, 0.0f) : size;
+        btCollisionShape* cShape = this->shapeCache.Acquire(key);
+        if (cShape == NULL)
         {
-            btVector3 dim = btVector3(size.x, size.y, size.z);
-            cShape = new btBoxShape(dim);
+            if (type == BOX)
+            {
+                btVector3 dim = btVector3(size.x, size.y, size.z);
+                cShape = new btBoxShape(dim);
+            }
+            else if (type == SPHERE)
+                cShape = new btSphereShape(size.x);
+            this->shapeCache.Add(key, cShape);
         }
-        else if (type == SPHERE)
-            cShape = new btSphereShape(size.x);
-            
-        this->collisionShapes.push_back(cShape);
         
         btTransform objTransform;
         objTransform.setIdentity();
@@ -70,33 +330,34 @@ public:
         }
         
         btRigidBody* body = new btRigidBody(rbInfo);
-        this->dynamicsWorld->addRigidBody(body);
+        if (group != 0)
+            this->dynamicsWorld->addRigidBody(body, group, mask);
+        else
+            this->dynamicsWorld->addRigidBody(body);
         
         return body;
     }
     
-    btRigidBody* createRigidBody(int type, glm::vec3 pos, glm::vec3 size, glm::vec3 rot, float m, float friction, float restitution, vector<Mesh> meshes)
+    btRigidBody* createRigidBody(int type, glm::vec3 pos, glm::vec3 size, glm::vec3 rot, float m, float friction, float restitution, const vector<Mesh>& meshes,
+                                 const string& file = "")
     {
-        btConvexHullShape* cShape = NULL;
-        
         btVector3 position = btVector3(pos.x, pos.y, pos.z);
         btQuaternion rotation;
         rotation.setEuler(rot.x, rot.y, rot.z);
         
-        cShape = new btConvexHullShape();
-        for (int i = 0; i<meshes.size(); i++)
+        // the hull is built only once for the same model file (or, if the file is not given, for the same meshes, identified by their VAOs)
+        ShapeKey key;
+        key.Type = CONVEX_HULL;
+        key.Size = glm::vec3(0.0f);
+        key.File = file;
+        if (file.empty())
         {
-            for (int j = 0; j<meshes[i].vertices.size(); j++)
-            {
-                cShape->addPoint(btVector3(meshes[i].vertices[j].Position.x, 
-                            meshes[i].vertices[j].Position.y, meshes[i].vertices[j].Position.z));
-            }
+            for (GLuint i = 0; i < meshes.size(); i++)
+                key.Meshes.push_back(meshes[i].VAO);
         }
-
-//        cShape->setLocalScaling(position);
-//        cShape->recalcLocalAabb();
-
-        this->collisionShapes.push_back(cShape);
+        btCollisionShape* cShape = this->shapeCache.Acquire(key);
+        if (cShape == NULL)
+            cShape = this->shapeCache.Add(key, this->buildHull(meshes));
         
         btTransform objTransform;
         objTransform.setIdentity();
@@ -122,6 +383,62 @@ public:
         return body;
     }
     
+    // projectiles (spheres with the given radius) are taken from a pool, instead of being created with createRigidBody:
+    // they are retired after lifetime seconds, or when they fall asleep, and at most maxProjectiles are in the world at the same time.
+    // Fast projectiles use CCD, depending on their speed and on the time step of the simulation
+    ProjectilePool* CreateProjectilePool(float radius, float m, float friction, float restitution, double lifetime, int maxProjectiles, double timeStep = 1.0 / 60.0)
+    {
+        delete this->projectiles;
+        this->projectiles = new ProjectilePool(this->dynamicsWorld, radius, m, friction, restitution, lifetime, maxProjectiles, timeStep);
+        return this->projectiles;
+    }
+    
+    // rigid body with a collision shape created outside (e.g., the TRIANGLE_MESH shape of a deformable model, see utils/mesh_collider.h).
+    // The shape is deallocated by Clear, like the other shapes
+    btRigidBody* createRigidBody(btCollisionShape* cShape, glm::vec3 pos, glm::vec3 rot, float m, float friction, float restitution, int group = 0, int mask = 0)
+    {
+        btVector3 position = btVector3(pos.x, pos.y, pos.z);
+        btQuaternion rotation;
+        rotation.setEuler(rot.x, rot.y, rot.z);
+        
+        this->collisionShapes.push_back(cShape);
+        
+        btTransform objTransform;
+        objTransform.setIdentity();
+        objTransform.setRotation(rotation);
+        objTransform.setOrigin(position);
+        
+        btScalar mass = m; // triangle meshes (btBvhTriangleMeshShape) can be used only for static objects (mass = 0)
+        bool isDynamic = (mass != 0.0f);
+        
+        btVector3 localInertia(0.0f, 0.0f, 0.0f);
+        if (isDynamic)
+            cShape->calculateLocalInertia(mass, localInertia);
+            
+        btDefaultMotionState* motionState = new btDefaultMotionState(objTransform);
+        
+        btRigidBody::btRigidBodyConstructionInfo rbInfo(mass, motionState, cShape, localInertia);
+        rbInfo.m_friction = friction;
+        rbInfo.m_restitution = restitution;
+        
+        btRigidBody* body = new btRigidBody(rbInfo);
+        if (group != 0)
+            this->dynamicsWorld->addRigidBody(body, group, mask);
+        else
+            this->dynamicsWorld->addRigidBody(body);
+        
+        return body;
+    }
+    
+    // the body is removed from the world and deallocated. Its shape is released (and deallocated, if no other body uses it)
+    void RemoveRigidBody(btRigidBody* body)
+    {
+        this->dynamicsWorld->removeRigidBody(body);
+        delete body->getMotionState();
+        this->shapeCache.Release(body->getCollisionShape());
+        delete body;
+    }
+    
 //    btRigidBody* createRigidBody(int type, glm::vec3 pos, glm::vec3 size, glm::vec3 rot, float m, float friction, float restitution, 
 //            const char* fileName, const char* preSwapFilenameOut)
 //    {
@@ -167,8 +484,37 @@ public:
 //        return body;
 //    }
     
+    // the state of the bodies of the scene is saved in the snapshot (the projectiles are not saved). It returns the number of saved bodies
+    int SaveSnapshot(WorldSnapshot& snapshot)
+    {
+        return snapshot.Capture(this->dynamicsWorld, PROJECTILE_GROUP);
+    }
+    
+    // the bodies of the scene are moved back to the state saved in the snapshot, and the projectiles are retired
+    bool RestoreSnapshot(const WorldSnapshot& snapshot)
+    {
+        if (this->projectiles)
+            this->projectiles->RetireAll();
+        return snapshot.Restore(this->dynamicsWorld, PROJECTILE_GROUP);
+    }
+    
+    // destructor: the world, and the threads which solve the islands, are deallocated
+    ~Physics()
+    {
+        this->Clear();
+    }
+    
+    // all the bodies and shapes are deallocated, then the world and its components, and the threads of the pool are joined.
+    // After Clear, the instance can not be used anymore
     void Clear()
     {
+        if (this->dynamicsWorld == NULL)
+            return;
+        
+        // the projectiles are removed from the world, and deallocated, by the pool
+        delete this->projectiles;
+        this->projectiles = NULL;
+        
         for (int i = this->dynamicsWorld->getNumCollisionObjects()-1; i>=0; i--)
         {
             btCollisionObject* obj = this->dynamicsWorld->getCollisionObjectArray()[i];
@@ -179,20 +525,91 @@ public:
             }
             this->dynamicsWorld->removeCollisionObject(obj);
             delete obj;
-            
-            for (int j = 0; j<this->collisionShapes.size(); j++)
+        }
+        
+        for (int j = 0; j<this->collisionShapes.size(); j++)
+        {
+            btCollisionShape* shape = this->collisionShapes[j];
+            this->collisionShapes[j] = 0;
+            delete shape;
+        }
+        this->collisionShapes.clear();
+        this->shapeCache.Clear();
+        
+        delete this->dynamicsWorld;
+        delete this->solver;
+        delete this->overlappingPairCache;
+        delete this->dispatcher;
+        delete this->collisionConfiguration;
+        this->dynamicsWorld = NULL;
+        this->solver = NULL;
+        this->overlappingPairCache = NULL;
+        this->dispatcher = NULL;
+        this->collisionConfiguration = NULL;
+        
+        // the destructor of the pool waits for the end of its threads
+        if (Physics::islandPool() == this->threadPool)
+            Physics::islandPool() = NULL;
+        delete this->threadPool;
+        this->threadPool = NULL;
+    }
+    
+private:
+    // convex hull of the vertices of the meshes, simplified to the support points of the 42 sample directions of btShapeHull.
+    // All the points are passed to the constructor of the full hull, so its AABB is computed once (addPoint recomputes it for each point)
+    btConvexHullShape* buildHull(const vector<Mesh>& meshes)
+    {
+        btAlignedObjectArray<btVector3> points;
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            for (GLuint j = 0; j < meshes[i].vertices.size(); j++)
             {
-                btCollisionShape* shape = this->collisionShapes[j];
-                this->collisionShapes[j] = 0;
-                delete shape;
+                const glm::vec3& p = meshes[i].vertices[j].Position;
+                points.push_back(btVector3(p.x, p.y, p.z));
             }
-            
-            delete this->dynamicsWorld;
-            delete this->solver;
-            delete this->overlappingPairCache;
-            delete this->dispatcher;
-            delete this->collisionConfiguration;
-            this->collisionShapes.clear();
         }
+        if (points.size() == 0)
+            return new btConvexHullShape();
+        
+        btConvexHullShape* fullHull = new btConvexHullShape((const btScalar*)&points[0], points.size());
+        // the support points must be the vertices, without the collision margin
+        fullHull->setMargin(0.0f);
+        btShapeHull simplified(fullHull);
+        if (!simplified.buildHull(0.0f))
+        {
+            cout << "ERROR::PHYSICS:: convex hull simplification failed, the full hull is used" << endl;
+            fullHull->setMargin(CONVEX_DISTANCE_MARGIN);
+            return fullHull;
+        }
+        delete fullHull;
+        
+        btConvexHullShape* hull = new btConvexHullShape((const btScalar*)simplified.getVertexPointer(), simplified.numVertices());
+        // interior and duplicated points are removed
+        hull->optimizeConvexHull();
+        return hull;
+    }
+    
+    // copy is not allowed (the world would be deallocated twice)
+    Physics(const Physics&);
+    Physics& operator=(const Physics&);
+    
+    // the island dispatch function of Bullet is a plain function, so the pool is stored in a static variable
+    static ThreadPool*& islandPool()
+    {
+        static ThreadPool* pool = NULL;
+        return pool;
+    }
+    
+    // each island is solved by one of the threads of the pool
+    static void parallelIslandDispatch(btAlignedObjectArray<btSimulationIslandManagerMt::Island*>* islands, btSimulationIslandManagerMt::IslandCallback* callback)
+    {
+        Physics::islandPool()->ParallelFor(islands->size(), [islands, callback](int item, int thread)
+        {
+            btSimulationIslandManagerMt::Island* island = (*islands)[item];
+            btPersistentManifold** manifolds = island->manifoldArray.size() ? &island->manifoldArray[0] : NULL;
+            btTypedConstraint** constraints = island->constraintArray.size() ? &island->constraintArray[0] : NULL;
+            callback->processIsland(&island->bodyArray[0], island->bodyArray.size(), manifolds, island->manifoldArray.size(),
+                                    constraints, island->constraintArray.size(), island->id);
+        });
     }
 };
\ No newline at end of file
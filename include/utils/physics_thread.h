@@ -0,0 +1,259 @@
+/*
+PhysicsThread class
+- the Bullet simulation runs on its own thread, with a fixed time step (default: 60 steps per second), independently from the frame rate:
+  a slow frame does not slow down the simulation, and the results do not depend on the rendering (same inputs -> same simulation)
+- if the thread falls behind (e.g., a very slow step), at most maxCatchUpSteps steps are performed to recover, and then the remaining time is dropped
+- after each step, an optional callback is called, with the world still locked (e.g., to record the new contacts, see utils/impact_queue.h)
+- the transforms of the dynamic bodies before and after the last step are published in a double buffer: the renderer reads the front buffer
+  (Interpolate), and interpolates between the two states, so the motion is smooth even if the frame rate is not a multiple of the simulation rate
+
+The world is protected by a mutex: the application must call Lock/Unlock around any access to the world (adding or removing bodies,
+reading contacts, changing shapes, ...). The renderer does not need the lock to read the published transforms.
+
+The rendered state is one step behind the simulation (the interpolation is between the last two computed states).
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <functional>
+
+#include <GLFW/glfw3.h>
+
+#include <bullet/btBulletDynamicsCommon.h>
+
+#include <utils/thread_pool.h>
+
+// data structure for the published state of a body
+struct BodyState {
+    const btRigidBody* Body;
+    // world transform before and after the last step
+    btTransform Previous;
+    btTransform Current;
+};
+
+// data structure for an interpolated transform
+struct BodyTransform {
+    const btRigidBody* Body;
+    btTransform Transform;
+};
+
+/////////////////// PHYSICS THREAD class ///////////////////////
+class PhysicsThread
+{
+public:
+    // function called after each step (simulation time in seconds, on the same clock of glfwGetTime)
+    typedef function<void(double)> StepCallback;
+
+    // fixed time step of the simulation (in seconds)
+    double timeStep;
+    // maximum number of steps performed to recover when the thread falls behind
+    int maxCatchUpSteps;
+
+    //////////////////////////////////////////
+    // Constructor
+    PhysicsThread(btDiscreteDynamicsWorld* world, double timeStep = 1.0 / 60.0, int maxCatchUpSteps = 5)
+    {
+        this->world = world;
+        this->timeStep = timeStep;
+        this->maxCatchUpSteps = maxCatchUpSteps;
+        this->running = false;
+        this->quit = false;
+        this->front = 0;
+        this->frontTime = 0.0;
+    }
+
+    // destructor: the thread is stopped
+    ~PhysicsThread()
+    {
+        this->Stop();
+    }
+
+    //////////////////////////////////////////
+
+    // the callback is called after each step, with the world locked
+    void SetStepCallback(const StepCallback& callback)
+    {
+        this->callback = callback;
+    }
+
+    // the simulation starts from the given time (glfwGetTime)
+    void Start(double time)
+    {
+        if (this->running)
+            return;
+        this->quit = false;
+        this->nextStep = time + this->timeStep;
+        this->frontTime = time;
+        this->running = true;
+#ifdef _WIN32
+        this->handle = CreateThread(NULL, 0, PhysicsThread::threadMain, this, 0, NULL);
+#else
+        pthread_create(&this->handle, NULL, PhysicsThread::threadMain, this);
+#endif
+    }
+
+    // the simulation is stopped, and the thread terminated
+    void Stop()
+    {
+        if (!this->running)
+            return;
+        this->quit = true;
+#ifdef _WIN32
+        WaitForSingleObject(this->handle, INFINITE);
+        CloseHandle(this->handle);
+#else
+        pthread_join(this->handle, NULL);
+#endif
+        this->running = false;
+    }
+
+    //////////////////////////////////////////
+
+    // exclusive access to the world, for the other threads
+    void Lock()
+    {
+        this->worldMutex.Lock();
+    }
+
+    void Unlock()
+    {
+        this->worldMutex.Unlock();
+    }
+
+    //////////////////////////////////////////
+
+    // transforms of the dynamic bodies at the given time (glfwGetTime), interpolated between the last two published states.
+    // It returns the number of bodies
+    int Interpolate(double time, vector<BodyTransform>& out)
+    {
+        this->publishMutex.Lock();
+        const vector<BodyState>& states = this->states[this->front];
+        btScalar alpha = (btScalar)((time - this->frontTime) / this->timeStep);
+        alpha = btMax(btScalar(0.0f), btMin(btScalar(1.0f), alpha));
+
+        out.resize(states.size());
+        for (GLuint i = 0; i < states.size(); i++)
+        {
+            const btTransform& a = states[i].Previous;
+            const btTransform& b = states[i].Current;
+            out[i].Body = states[i].Body;
+            out[i].Transform.setOrigin(a.getOrigin().lerp(b.getOrigin(), alpha));
+            out[i].Transform.setRotation(a.getRotation().slerp(b.getRotation(), alpha));
+        }
+        this->publishMutex.Unlock();
+        return out.size();
+    }
+
+private:
+    btDiscreteDynamicsWorld* world;
+    StepCallback callback;
+    Mutex worldMutex;
+    // double buffer of the published states: the renderer reads states[front], the simulation writes the other one
+    vector<BodyState> states[2];
+    int front;
+    // time of the Current transforms of the front buffer
+    double frontTime;
+    Mutex publishMutex;
+    // time of the next step
+    double nextStep;
+    volatile bool running;
+    volatile bool quit;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+
+    // copy is not allowed (the thread would be stopped twice)
+    PhysicsThread(const PhysicsThread&);
+    PhysicsThread& operator=(const PhysicsThread&);
+
+    //////////////////////////////////////////
+
+    void loop()
+    {
+        while (!this->quit)
+        {
+            double now = glfwGetTime();
+            if (now < this->nextStep)
+            {
+                sleep(this->nextStep - now);
+                continue;
+            }
+
+            vector<BodyState>& back = this->states[1 - this->front];
+            this->worldMutex.Lock();
+            int steps = 0;
+            while (this->nextStep <= now && steps < this->maxCatchUpSteps)
+            {
+                this->record(back, true);
+                this->world->stepSimulation(this->timeStep, 1, this->timeStep);
+                this->record(back, false);
+                if (this->callback)
+                    this->callback(this->nextStep);
+                this->nextStep += this->timeStep;
+                steps++;
+            }
+            this->worldMutex.Unlock();
+
+            // the simulation is too slow: the remaining time is dropped
+            if (this->nextStep <= now)
+                this->nextStep = now + this->timeStep;
+
+            this->publishMutex.Lock();
+            this->front = 1 - this->front;
+            this->frontTime = this->nextStep - this->timeStep;
+            this->publishMutex.Unlock();
+        }
+    }
+
+    // transforms of the dynamic bodies before (previous = true) or after the step
+    void record(vector<BodyState>& states, bool previous)
+    {
+        const btCollisionObjectArray& objects = this->world->getCollisionObjectArray();
+        if (previous)
+            states.clear();
+        GLuint n = 0;
+        for (int i = 0; i < objects.size(); i++)
+        {
+            const btRigidBody* body = btRigidBody::upcast(objects[i]);
+            if (body == NULL || body->isStaticOrKinematicObject())
+                continue;
+            if (previous)
+            {
+                BodyState state = {body, body->getWorldTransform(), body->getWorldTransform()};
+                states.push_back(state);
+            }
+            // the bodies are not added or removed during a step, so they are in the same order
+            else
+                states[n++].Current = body->getWorldTransform();
+        }
+    }
+
+    static void sleep(double seconds)
+    {
+#ifdef _WIN32
+        Sleep((DWORD)(seconds * 1000.0));
+#else
+        usleep((useconds_t)(seconds * 1000000.0));
+#endif
+    }
+
+#ifdef _WIN32
+    static DWORD WINAPI threadMain(LPVOID param)
+    {
+        ((PhysicsThread*)param)->loop();
+        return 0;
+    }
+#else
+    static void* threadMain(void* param)
+    {
+        ((PhysicsThread*)param)->loop();
+        return NULL;
+    }
+#endif
+};
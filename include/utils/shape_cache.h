@@ -0,0 +1,118 @@
+/*
+ShapeCache class
+- registry of the collision shapes used by the rigid bodies, so bodies with the same shape share the same btCollisionShape instance
+- shapes are identified by a key: type of the shape, dimensions (box half extents, sphere radius), and, for the shapes built from meshes,
+  the file of the model, or the identity of the meshes (their VAO names, which do not change when a Mesh is copied) if the file is not known.
+  With the file, all the models loaded from the same file share the same shape
+- each shape has a reference count: Acquire returns the shape for a key (if already created) and increments the count, Release decrements it,
+  and the shape is deallocated when it is not used anymore
+
+Sharing shapes reduces memory use, and the narrow phase reads the same shape data for many objects (better cache behaviour).
+N.B.) shared shapes must not be modified per body (e.g., setLocalScaling would change all the bodies using the shape)
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <map>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include <bullet/btBulletDynamicsCommon.h>
+
+// data structure for the key of a shape
+struct ShapeKey {
+    // type of the shape (see enum shapes in utils/physics.h)
+    int Type;
+    // dimensions of the shape
+    glm::vec3 Size;
+    // identity of the meshes used to build the shape (empty for the analytic shapes)
+    vector<GLuint> Meshes;
+    // file of the model used to build the shape (empty if not known)
+    string File;
+
+    bool operator<(const ShapeKey& other) const
+    {
+        if (this->Type != other.Type)
+            return this->Type < other.Type;
+        if (this->Size.x != other.Size.x)
+            return this->Size.x < other.Size.x;
+        if (this->Size.y != other.Size.y)
+            return this->Size.y < other.Size.y;
+        if (this->Size.z != other.Size.z)
+            return this->Size.z < other.Size.z;
+        if (this->File != other.File)
+            return this->File < other.File;
+        return this->Meshes < other.Meshes;
+    }
+};
+
+/////////////////// SHAPE CACHE class ///////////////////////
+class ShapeCache
+{
+public:
+    //////////////////////////////////////////
+
+    // shape with the given key, if already created (its reference count is incremented), otherwise NULL
+    btCollisionShape* Acquire(const ShapeKey& key)
+    {
+        map<ShapeKey, btCollisionShape*>::iterator it = this->shapes.find(key);
+        if (it == this->shapes.end())
+            return NULL;
+        this->references[it->second]++;
+        return it->second;
+    }
+
+    // a new shape is registered with the given key (with reference count = 1)
+    btCollisionShape* Add(const ShapeKey& key, btCollisionShape* shape)
+    {
+        this->shapes[key] = shape;
+        this->keys[shape] = key;
+        this->references[shape] = 1;
+        return shape;
+    }
+
+    // a body does not use the shape anymore: if no other body uses it, the shape is deallocated.
+    // It returns false if the shape is not in the cache
+    bool Release(btCollisionShape* shape)
+    {
+        map<btCollisionShape*, int>::iterator it = this->references.find(shape);
+        if (it == this->references.end())
+            return false;
+        if (--it->second == 0)
+        {
+            this->shapes.erase(this->keys[shape]);
+            this->keys.erase(shape);
+            this->references.erase(it);
+            delete shape;
+        }
+        return true;
+    }
+
+    // number of different shapes in the cache
+    int Size() const
+    {
+        return this->shapes.size();
+    }
+
+    //////////////////////////////////////////
+
+    // all the shapes are deallocated
+    void Clear()
+    {
+        for (map<btCollisionShape*, int>::iterator it = this->references.begin(); it != this->references.end(); ++it)
+            delete it->first;
+        this->shapes.clear();
+        this->keys.clear();
+        this->references.clear();
+    }
+
+private:
+    map<ShapeKey, btCollisionShape*> shapes;
+    map<btCollisionShape*, ShapeKey> keys;
+    map<btCollisionShape*, int> references;
+};
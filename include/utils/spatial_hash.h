@@ -0,0 +1,190 @@
+/*
+SpatialHash class
+- uniform grid over the vertices of a model (in model coordinates), stored as a hash table of cells
+- given a point and a radius, it returns only the vertices inside the radius, visiting just the cells overlapping the sphere: the cost of a query depends on the size of the dent, and not on the resolution of the mesh
+- when a vertex is moved, its entry is moved to the new cell (Update), so the grid can be kept in sync with the deformations
+
+Each vertex of each mesh of the model has an entry; entries of the same bucket are linked in a list (head/next arrays), so no allocation is performed after Build.
+
+N.B.) the header uses the Mesh class, so it must be included after utils/mesh_v2.h
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+/////////////////// SPATIAL HASH class ///////////////////////
+class SpatialHash
+{
+public:
+    // size of a cell (in model coordinates)
+    float cellSize;
+
+    //////////////////////////////////////////
+    // Constructor
+    SpatialHash()
+    {
+        this->cellSize = 1.0f;
+    }
+
+    //////////////////////////////////////////
+
+    // builds the grid over all the vertices of the meshes.
+    // If cellSize is 0, the size is calculated so that the largest side of the bounding box is split in 32 cells
+    void Build(const vector<Mesh>& meshes, float cellSize = 0.0f)
+    {
+        GLuint total = 0;
+        glm::vec3 minPos(0.0f), maxPos(0.0f);
+        this->firstEntry.clear();
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            this->firstEntry.push_back(total);
+            for (GLuint j = 0; j < meshes[i].streams.Size(); j++)
+            {
+                glm::vec3 p = meshes[i].streams.Position(j);
+                if (total == 0 && j == 0)
+                    minPos = maxPos = p;
+                minPos = glm::min(minPos, p);
+                maxPos = glm::max(maxPos, p);
+            }
+            total += meshes[i].streams.Size();
+        }
+
+        if (cellSize <= 0.0f)
+        {
+            glm::vec3 extent = maxPos - minPos;
+            cellSize = glm::max(glm::max(extent.x, extent.y), extent.z) / 32.0f;
+            if (cellSize <= 0.0f)
+                cellSize = 1.0f;
+        }
+        this->cellSize = cellSize;
+
+        // number of buckets = power of 2 >= number of vertices
+        GLuint numBuckets = 1;
+        while (numBuckets < total)
+            numBuckets <<= 1;
+        this->mask = numBuckets - 1;
+        this->head.assign(numBuckets, -1);
+
+        this->next.resize(total);
+        this->cell.resize(total);
+        this->meshIndex.resize(total);
+        this->vertexIndex.resize(total);
+
+        int e = 0;
+        for (GLuint i = 0; i < meshes.size(); i++)
+        {
+            for (GLuint j = 0; j < meshes[i].streams.Size(); j++, e++)
+            {
+                this->meshIndex[e] = i;
+                this->vertexIndex[e] = j;
+                this->insert(e, this->cellOf(meshes[i].streams.Position(j)));
+            }
+        }
+    }
+
+    // the j-th vertex of the i-th mesh has been moved: if it has changed cell, the entry is moved
+    void Update(GLuint i, GLuint j, const glm::vec3& position)
+    {
+        int e = this->firstEntry[i] + j;
+        glm::ivec3 c = this->cellOf(position);
+        if (c == this->cell[e])
+            return;
+        this->remove(e);
+        this->insert(e, c);
+    }
+
+    // bounds (in model coordinates) of the cell where the j-th vertex of the i-th mesh is registered:
+    // before Update, the box contains the previous position of the vertex
+    void CellBounds(GLuint i, GLuint j, glm::vec3& cellMin, glm::vec3& cellMax) const
+    {
+        cellMin = glm::vec3(this->cell[this->firstEntry[i] + j]) * this->cellSize;
+        cellMax = cellMin + glm::vec3(this->cellSize);
+    }
+
+    // indices of the vertices inside the sphere (center and radius in model coordinates), one vector for each mesh.
+    // It returns the total number of vertices found.
+    int Query(const vector<Mesh>& meshes, const glm::vec3& center, float radius, vector<vector<GLuint> >& result) const
+    {
+        result.resize(meshes.size());
+        for (GLuint i = 0; i < result.size(); i++)
+            result[i].clear();
+        if (this->head.empty())
+            return 0;
+
+        glm::ivec3 cmin = this->cellOf(center - glm::vec3(radius));
+        glm::ivec3 cmax = this->cellOf(center + glm::vec3(radius));
+        float radius2 = radius * radius;
+        int found = 0;
+
+        for (int x = cmin.x; x <= cmax.x; x++)
+            for (int y = cmin.y; y <= cmax.y; y++)
+                for (int z = cmin.z; z <= cmax.z; z++)
+                {
+                    glm::ivec3 c(x, y, z);
+                    for (int e = this->head[this->hash(c)]; e != -1; e = this->next[e])
+                    {
+                        // different cells can share the same bucket
+                        if (this->cell[e] != c)
+                            continue;
+                        GLuint i = this->meshIndex[e];
+                        GLuint j = this->vertexIndex[e];
+                        glm::vec3 d = meshes[i].streams.Position(j) - center;
+                        if (glm::dot(d, d) <= radius2)
+                        {
+                            result[i].push_back(j);
+                            found++;
+                        }
+                    }
+                }
+        return found;
+    }
+
+private:
+    // first bucket entry (-1 if empty)
+    vector<int> head;
+    // for each entry: next entry in the same bucket, cell, and corresponding mesh and vertex
+    vector<int> next;
+    vector<glm::ivec3> cell;
+    vector<GLuint> meshIndex;
+    vector<GLuint> vertexIndex;
+    // index of the first entry of each mesh
+    vector<GLuint> firstEntry;
+    GLuint mask;
+
+    //////////////////////////////////////////
+
+    glm::ivec3 cellOf(const glm::vec3& p) const
+    {
+        return glm::ivec3(floor(p.x / this->cellSize), floor(p.y / this->cellSize), floor(p.z / this->cellSize));
+    }
+
+    // hash function of "Optimized Spatial Hashing for Collision Detection of Deformable Objects" (Teschner et al., 2003)
+    GLuint hash(const glm::ivec3& c) const
+    {
+        return ((GLuint)c.x * 73856093u ^ (GLuint)c.y * 19349663u ^ (GLuint)c.z * 83492791u) & this->mask;
+    }
+
+    void insert(int e, const glm::ivec3& c)
+    {
+        GLuint b = this->hash(c);
+        this->cell[e] = c;
+        this->next[e] = this->head[b];
+        this->head[b] = e;
+    }
+
+    void remove(int e)
+    {
+        GLuint b = this->hash(this->cell[e]);
+        int* link = &this->head[b];
+        while (*link != e)
+            link = &this->next[*link];
+        *link = this->next[e];
+    }
+};
@@ -0,0 +1,258 @@
+/*
+TextureCache class
+- binary cache of the decoded textures, written after the first decoding of an image file with stb_image, next to the image (<image file>.texcache)
+- the cache contains the texels of all the mipmap levels, computed on the CPU (2x2 box filter) when the cache is written: in the following runs
+  (and when the scene is loaded again), each level is read with a single read, and sent directly to glTexImage2D, so JPEG/PNG decoding
+  and glGenerateMipmap are skipped
+- the cache is versioned, like the mesh cache (see utils/mesh_cache.h): it is used only if it has been written by the same version of the format,
+  and if size and modification time of the image file are the ones saved in the cache. Otherwise, the image is decoded again, and the cache is rewritten
+- images used without mipmaps (e.g., the faces of a cubemap) are cached with only the first level. A cache with all the levels is used also when
+  the mipmaps are not needed (only the first level is read)
+
+Layout of the file: header, level entries, then the texels of each level (rows are tightly packed, with the number of channels of the image file).
+
+N.B.) the texels are not block-compressed: the first level is the same image uploaded before. The mipmaps are computed with a 2x2 box filter,
+which can differ slightly from the filter used by the driver in glGenerateMipmap (e.g., on the last row or column of levels with an odd size)
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// GL Includes
+#include <glad/glad.h>
+
+// we include the library for image loading
+#include <stb_image/stb_image.h>
+
+// version of the format of the cache: it must be incremented when the layout of the file, or the computation of the mipmaps, is changed
+const GLuint TEXTURE_CACHE_VERSION = 1;
+
+// data structure for a decoded image (see TextureCache::Load, and TextureFromImage in utils/model_v2.h)
+struct ImageData {
+    // path of the image (as written in the material of the model)
+    string Path;
+    int Width, Height, Channels;
+    // texels of each level (level 0 = full resolution, then the mipmaps, each half the size of the previous one), with tightly packed rows
+    vector<vector<unsigned char> > Levels;
+};
+
+// data structure for the header of the cache
+struct TextureCacheHeader {
+    // "RTTC"
+    char Magic[4];
+    GLuint Version;
+    // size and modification time of the image file
+    long long SourceSize;
+    long long SourceTime;
+    GLuint Width;
+    GLuint Height;
+    GLuint Channels;
+    GLuint NumLevels;
+};
+
+// data structure for a level in the cache
+struct TextureCacheLevel {
+    GLuint Width;
+    GLuint Height;
+    // offset of the texels from the beginning of the file, and their size (in bytes)
+    unsigned long long Offset;
+    unsigned long long Size;
+};
+
+/////////////////// TEXTURE CACHE class ///////////////////////
+class TextureCache
+{
+public:
+    //////////////////////////////////////////
+
+    // path of the cache of an image file
+    static string CachePath(const string& imagePath)
+    {
+        return imagePath + ".texcache";
+    }
+
+    // the image is read from its cache (with all the mipmap levels, if mipmaps is true). If the cache is missing or out of date, the image file
+    // is decoded with stb_image, the mipmaps are computed, and the cache is written. It does not call OpenGL, so it can be called by a worker thread.
+    // It returns false if the image cannot be read
+    static bool Load(const string& path, ImageData& image, bool mipmaps = true)
+    {
+        image.Path = path;
+        if (TextureCache::read(path, mipmaps, image))
+            return true;
+        if (!TextureCache::decode(path, image))
+            return false;
+        if (mipmaps)
+            TextureCache::BuildMipmaps(image);
+        TextureCache::write(path, image);
+        return true;
+    }
+
+    // the mipmap levels of the image are computed from the first one (2x2 box filter), down to 1x1. Each level has half the size
+    // (rounded down) of the previous one, so with an odd size the last row (column) of the previous level is dropped
+    static void BuildMipmaps(ImageData& image)
+    {
+        image.Levels.resize(1);
+        int w = image.Width;
+        int h = image.Height;
+        int c = image.Channels;
+        while (w > 1 || h > 1)
+        {
+            int nw = w > 1 ? w / 2 : 1;
+            int nh = h > 1 ? h / 2 : 1;
+            vector<unsigned char> level(nw * nh * c);
+            const vector<unsigned char>& src = image.Levels.back();
+            for (int y = 0; y < nh; y++)
+            {
+                // a size of 1 is not halved: the only row (column) is used twice
+                const unsigned char* row0 = &src[(2 * y) * w * c];
+                const unsigned char* row1 = &src[min(2 * y + 1, h - 1) * w * c];
+                for (int x = 0; x < nw; x++)
+                {
+                    int x0 = 2 * x * c;
+                    int x1 = min(2 * x + 1, w - 1) * c;
+                    for (int k = 0; k < c; k++)
+                        level[(y * nw + x) * c + k] = (unsigned char)((row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k] + 2) / 4);
+                }
+            }
+            image.Levels.push_back(level);
+            w = nw;
+            h = nh;
+        }
+    }
+
+    // number of levels of the full mipmap chain of an image
+    static GLuint NumLevels(int width, int height)
+    {
+        GLuint levels = 1;
+        while (width > 1 || height > 1)
+        {
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+            levels++;
+        }
+        return levels;
+    }
+
+private:
+    //////////////////////////////////////////
+
+    // the image file is decoded in the first level (with the number of channels of the file)
+    static bool decode(const string& path, ImageData& image)
+    {
+        unsigned char* pixels = stbi_load(path.c_str(), &image.Width, &image.Height, &image.Channels, 0);
+        if (pixels == NULL)
+        {
+            cout << "ERROR::TEXTURE:: failed to load " << path << endl;
+            image.Width = image.Height = image.Channels = 0;
+            image.Levels.clear();
+            return false;
+        }
+        image.Levels.assign(1, vector<unsigned char>(pixels, pixels + image.Width * image.Height * image.Channels));
+        stbi_image_free(pixels);
+        return true;
+    }
+
+    // the levels are read from the cache, if it is valid and it has all the needed levels. Each level is read with a single read
+    static bool read(const string& path, bool mipmaps, ImageData& image)
+    {
+        TextureCacheHeader current;
+        if (!TextureCache::makeHeader(path, current))
+            return false;
+        ifstream in(TextureCache::CachePath(path).c_str(), ios::binary);
+        if (!in)
+            return false;
+
+        TextureCacheHeader header;
+        in.read((char*)&header, sizeof(header));
+        if (!in || memcmp(header.Magic, current.Magic, 4) != 0 || header.Version != current.Version ||
+            header.SourceSize != current.SourceSize || header.SourceTime != current.SourceTime || header.NumLevels == 0)
+            return false;
+        GLuint needed = mipmaps ? TextureCache::NumLevels(header.Width, header.Height) : 1;
+        if (header.NumLevels < needed)
+            return false;
+
+        vector<TextureCacheLevel> levels(header.NumLevels);
+        in.read((char*)&levels[0], levels.size() * sizeof(TextureCacheLevel));
+        if (!in)
+            return false;
+
+        image.Width = header.Width;
+        image.Height = header.Height;
+        image.Channels = header.Channels;
+        image.Levels.resize(needed);
+        for (GLuint i = 0; i < needed; i++)
+        {
+            image.Levels[i].resize(levels[i].Size);
+            in.seekg(levels[i].Offset);
+            in.read((char*)&image.Levels[i][0], levels[i].Size);
+        }
+        if (!in)
+        {
+            cout << "WARNING::TEXTURE_CACHE:: the cache of " << path << " is truncated" << endl;
+            image.Levels.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // the cache is written with the levels of the image. It returns false if the file cannot be written
+    static bool write(const string& path, const ImageData& image)
+    {
+        TextureCacheHeader header;
+        if (!TextureCache::makeHeader(path, header))
+            return false;
+        header.Width = image.Width;
+        header.Height = image.Height;
+        header.Channels = image.Channels;
+        header.NumLevels = image.Levels.size();
+
+        vector<TextureCacheLevel> levels(image.Levels.size());
+        unsigned long long offset = sizeof(TextureCacheHeader) + levels.size() * sizeof(TextureCacheLevel);
+        for (GLuint i = 0; i < levels.size(); i++)
+        {
+            levels[i].Width = max(image.Width >> i, 1);
+            levels[i].Height = max(image.Height >> i, 1);
+            levels[i].Offset = offset;
+            levels[i].Size = image.Levels[i].size();
+            offset += levels[i].Size;
+        }
+
+        ofstream out(TextureCache::CachePath(path).c_str(), ios::binary | ios::trunc);
+        if (!out)
+        {
+            cout << "WARNING::TEXTURE_CACHE:: cannot write the cache of " << path << endl;
+            return false;
+        }
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)&levels[0], levels.size() * sizeof(TextureCacheLevel));
+        for (GLuint i = 0; i < image.Levels.size(); i++)
+            out.write((const char*)&image.Levels[i][0], image.Levels[i].size());
+        return out.good();
+    }
+
+    // header for the current version of the format, and the current state of the image file. It returns false if the image file does not exist
+    static bool makeHeader(const string& path, TextureCacheHeader& header)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.Magic, "RTTC", 4);
+        header.Version = TEXTURE_CACHE_VERSION;
+        header.SourceSize = info.st_size;
+        header.SourceTime = info.st_mtime;
+        return true;
+    }
+};
@@ -0,0 +1,311 @@
+/*
+ThreadPool class
+- fixed set of worker threads, created once, which sleep until some work is available
+- ParallelFor(count, body): body(item, thread) is called for each item in [0, count), distributing the items among the workers and the calling thread;
+  the call returns when all the items have been processed. thread is the index (0 = calling thread, 1..n-1 = workers) of the thread running the item
+- items are taken one at a time with an atomic counter, so threads which finish first take more items (islands of the physics simulation can have very different sizes)
+- the header provides also the Semaphore and Mutex classes used by the pool, and by the other threads of the application (see utils/physics_thread.h)
+
+MinGW (win32 thread model) does not provide std::thread and std::mutex, so native threads are used: Win32 threads and semaphores on Windows, pthreads elsewhere.
+Atomic operations use the GCC builtins (available in both MinGW and clang).
+
+N.B.) ParallelFor must be called by one thread at a time (the thread which owns the pool)
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <functional>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/////////////////// SEMAPHORE class ///////////////////////
+// counting semaphore used to wake the workers, and to signal the end of the work
+class Semaphore
+{
+public:
+    Semaphore()
+    {
+#ifdef _WIN32
+        this->handle = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+#else
+        this->count = 0;
+        pthread_mutex_init(&this->mutex, NULL);
+        pthread_cond_init(&this->cond, NULL);
+#endif
+    }
+
+    ~Semaphore()
+    {
+#ifdef _WIN32
+        CloseHandle(this->handle);
+#else
+        pthread_cond_destroy(&this->cond);
+        pthread_mutex_destroy(&this->mutex);
+#endif
+    }
+
+    void Signal(int n = 1)
+    {
+#ifdef _WIN32
+        ReleaseSemaphore(this->handle, n, NULL);
+#else
+        pthread_mutex_lock(&this->mutex);
+        this->count += n;
+        pthread_cond_broadcast(&this->cond);
+        pthread_mutex_unlock(&this->mutex);
+#endif
+    }
+
+    void Wait()
+    {
+#ifdef _WIN32
+        WaitForSingleObject(this->handle, INFINITE);
+#else
+        pthread_mutex_lock(&this->mutex);
+        while (this->count == 0)
+            pthread_cond_wait(&this->cond, &this->mutex);
+        this->count--;
+        pthread_mutex_unlock(&this->mutex);
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+
+    // copy is not allowed (the handles would be closed twice)
+    Semaphore(const Semaphore&);
+    Semaphore& operator=(const Semaphore&);
+};
+
+/////////////////// MUTEX class ///////////////////////
+// mutual exclusion between threads (CRITICAL_SECTION on Windows)
+class Mutex
+{
+public:
+    Mutex()
+    {
+#ifdef _WIN32
+        InitializeCriticalSection(&this->section);
+#else
+        pthread_mutex_init(&this->mutex, NULL);
+#endif
+    }
+
+    ~Mutex()
+    {
+#ifdef _WIN32
+        DeleteCriticalSection(&this->section);
+#else
+        pthread_mutex_destroy(&this->mutex);
+#endif
+    }
+
+    void Lock()
+    {
+#ifdef _WIN32
+        EnterCriticalSection(&this->section);
+#else
+        pthread_mutex_lock(&this->mutex);
+#endif
+    }
+
+    void Unlock()
+    {
+#ifdef _WIN32
+        LeaveCriticalSection(&this->section);
+#else
+        pthread_mutex_unlock(&this->mutex);
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    CRITICAL_SECTION section;
+#else
+    pthread_mutex_t mutex;
+#endif
+
+    // copy is not allowed
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+};
+
+/////////////////// THREAD POOL class ///////////////////////
+class ThreadPool
+{
+public:
+    // function called for each item: (item, index of the thread)
+    typedef function<void(int, int)> Body;
+
+    //////////////////////////////////////////
+    // Constructor (total number of threads, including the calling thread: numThreads - 1 workers are created)
+    ThreadPool(int numThreads)
+    {
+        this->quit = false;
+        this->body = NULL;
+        this->count = 0;
+        this->nextItem = 0;
+        this->running = 0;
+        for (int i = 1; i < numThreads; i++)
+        {
+            Worker* w = new Worker();
+            w->pool = this;
+            w->index = i;
+#ifdef _WIN32
+            w->handle = CreateThread(NULL, 0, ThreadPool::workerMain, w, 0, NULL);
+#else
+            pthread_create(&w->handle, NULL, ThreadPool::workerMain, w);
+#endif
+            this->workers.push_back(w);
+        }
+    }
+
+    // destructor: the workers are woken up, and terminated
+    ~ThreadPool()
+    {
+        this->quit = true;
+        this->wake.Signal(this->workers.size());
+        for (size_t i = 0; i < this->workers.size(); i++)
+        {
+#ifdef _WIN32
+            WaitForSingleObject(this->workers[i]->handle, INFINITE);
+            CloseHandle(this->workers[i]->handle);
+#else
+            pthread_join(this->workers[i]->handle, NULL);
+#endif
+            delete this->workers[i];
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // number of threads (calling thread + workers)
+    int Size() const
+    {
+        return this->workers.size() + 1;
+    }
+
+    // number of cores of the machine
+    static int HardwareThreads()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+#else
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? n : 1;
+#endif
+    }
+
+    //////////////////////////////////////////
+
+    // body is called for each item in [0, count), by all the threads of the pool. It returns when all the items have been processed
+    void ParallelFor(int count, const Body& body)
+    {
+        if (count <= 0)
+            return;
+        // with a single item (or no workers), the overhead of waking the workers is avoided
+        if (count == 1 || this->workers.empty())
+        {
+            for (int i = 0; i < count; i++)
+                body(i, 0);
+            return;
+        }
+
+        this->body = &body;
+        this->count = count;
+        this->nextItem = 0;
+        this->running = this->workers.size();
+        __sync_synchronize();
+        this->wake.Signal(this->workers.size());
+
+        this->process(0);
+
+        // the last worker which finishes signals the end of the work
+        this->done.Wait();
+        this->body = NULL;
+    }
+
+private:
+    struct Worker
+    {
+        ThreadPool* pool;
+        int index;
+#ifdef _WIN32
+        HANDLE handle;
+#else
+        pthread_t handle;
+#endif
+    };
+
+    vector<Worker*> workers;
+    Semaphore wake, done;
+    volatile bool quit;
+    // current work: body, number of items, next item to process, number of workers still running
+    const Body* body;
+    int count;
+    volatile int nextItem;
+    volatile int running;
+
+    // copy is not allowed (the workers would be terminated twice)
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    //////////////////////////////////////////
+
+    // items are taken until all of them have been assigned
+    void process(int thread)
+    {
+        int item;
+        while ((item = __sync_fetch_and_add(&this->nextItem, 1)) < this->count)
+            (*this->body)(item, thread);
+    }
+
+    void workerLoop(int thread)
+    {
+        while (true)
+        {
+            this->wake.Wait();
+            if (this->quit)
+                return;
+            this->process(thread);
+            if (__sync_sub_and_fetch(&this->running, 1) == 0)
+                this->done.Signal();
+        }
+    }
+
+#ifdef _WIN32
+    static DWORD WINAPI workerMain(LPVOID param)
+    {
+        Worker* w = (Worker*)param;
+        w->pool->workerLoop(w->index);
+        return 0;
+    }
+#else
+    static void* workerMain(void* param)
+    {
+        Worker* w = (Worker*)param;
+        w->pool->workerLoop(w->index);
+        return NULL;
+    }
+#endif
+};
@@ -0,0 +1,176 @@
+/*
+VertexStreams class
+- structure-of-arrays (SoA) copy of the positions and normals of a mesh, kept alongside the array of Vertex structures (Mesh::vertices)
+- each coordinate is stored in its own array, so the deformation kernels can load the same coordinate of several consecutive vertices with a single instruction
+
+SIMD width depends on the instruction set enabled at compile time:
+- AVX2 (e.g., -mavx2): 8 vertices per instruction
+- SSE2 (default on x86-64; the 32 bit MinGW build of the projects enables it with -msse2 -mfpmath=sse, see the .project/.mk files): 4 vertices per instruction
+- otherwise, the scalar fallback processes 1 vertex at a time
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
+
+//////////////////////////////////////////
+// thin wrappers over the SIMD intrinsics, so the kernels are written once for AVX2 and SSE2
+#if SIMD_WIDTH == 8
+typedef __m256 simd_float;
+static inline simd_float simd_load(const float* p) { return _mm256_loadu_ps(p); }
+static inline void simd_store(float* p, simd_float a) { _mm256_storeu_ps(p, a); }
+static inline simd_float simd_set1(float a) { return _mm256_set1_ps(a); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+static inline simd_float simd_div(simd_float a, simd_float b) { return _mm256_div_ps(a, b); }
+static inline simd_float simd_sqrt(simd_float a) { return _mm256_sqrt_ps(a); }
+// sign flip (exact, like the unary minus)
+static inline simd_float simd_neg(simd_float a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+// same semantic of glm::min(a, b): (b < a) ? b : a
+static inline simd_float simd_min(simd_float a, simd_float b) { return _mm256_blendv_ps(a, b, _mm256_cmp_ps(b, a, _CMP_LT_OQ)); }
+static inline simd_float simd_cmplt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline simd_float simd_cmpneq(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+static inline simd_float simd_or(simd_float a, simd_float b) { return _mm256_or_ps(a, b); }
+static inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, mask); }
+static inline int simd_movemask(simd_float a) { return _mm256_movemask_ps(a); }
+// loads the same coordinate of 8 consecutive vec3 pairs (position, normal) of an interleaved array
+static inline simd_float simd_load_interleaved(const float* p)
+{
+    return _mm256_i32gather_ps(p, _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42), 4);
+}
+// loads the elements of p at 8 (not consecutive) indices
+static inline simd_float simd_gather(const float* p, const GLuint* indices)
+{
+    return _mm256_i32gather_ps(p, _mm256_loadu_si256((const __m256i*)indices), 4);
+}
+#elif SIMD_WIDTH == 4
+typedef __m128 simd_float;
+static inline simd_float simd_load(const float* p) { return _mm_loadu_ps(p); }
+static inline void simd_store(float* p, simd_float a) { _mm_storeu_ps(p, a); }
+static inline simd_float simd_set1(float a) { return _mm_set1_ps(a); }
+static inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+static inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+static inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+static inline simd_float simd_div(simd_float a, simd_float b) { return _mm_div_ps(a, b); }
+static inline simd_float simd_sqrt(simd_float a) { return _mm_sqrt_ps(a); }
+// sign flip (exact, like the unary minus)
+static inline simd_float simd_neg(simd_float a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+static inline simd_float simd_cmplt(simd_float a, simd_float b) { return _mm_cmplt_ps(a, b); }
+static inline simd_float simd_cmpneq(simd_float a, simd_float b) { return _mm_cmpneq_ps(a, b); }
+static inline simd_float simd_or(simd_float a, simd_float b) { return _mm_or_ps(a, b); }
+static inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+// same semantic of glm::min(a, b): (b < a) ? b : a
+static inline simd_float simd_min(simd_float a, simd_float b) { return simd_select(_mm_cmplt_ps(b, a), b, a); }
+static inline int simd_movemask(simd_float a) { return _mm_movemask_ps(a); }
+// loads the same coordinate of 4 consecutive vec3 pairs (position, normal) of an interleaved array
+static inline simd_float simd_load_interleaved(const float* p)
+{
+    return _mm_setr_ps(p[0], p[6], p[12], p[18]);
+}
+// loads the elements of p at 4 (not consecutive) indices
+static inline simd_float simd_gather(const float* p, const GLuint* indices)
+{
+    return _mm_setr_ps(p[indices[0]], p[indices[1]], p[indices[2]], p[indices[3]]);
+}
+#endif
+
+/////////////////// VERTEX STREAMS class ///////////////////////
+class VertexStreams
+{
+public:
+    // one array for each coordinate of positions and normals
+    vector<float> PosX, PosY, PosZ;
+    vector<float> NormX, NormY, NormZ;
+
+    //////////////////////////////////////////
+
+    // (re)builds the arrays from the vertices of the mesh
+    void Build(const vector<Vertex>& vertices)
+    {
+        GLuint n = vertices.size();
+        PosX.resize(n); PosY.resize(n); PosZ.resize(n);
+        NormX.resize(n); NormY.resize(n); NormZ.resize(n);
+        for (GLuint i = 0; i < n; i++)
+            this->Set(i, vertices[i].Position, vertices[i].Normal);
+    }
+
+    GLuint Size() const
+    {
+        return PosX.size();
+    }
+
+    glm::vec3 Position(GLuint i) const
+    {
+        return glm::vec3(PosX[i], PosY[i], PosZ[i]);
+    }
+
+    glm::vec3 Normal(GLuint i) const
+    {
+        return glm::vec3(NormX[i], NormY[i], NormZ[i]);
+    }
+
+    void Set(GLuint i, const glm::vec3& position, const glm::vec3& normal)
+    {
+        PosX[i] = position.x; PosY[i] = position.y; PosZ[i] = position.z;
+        NormX[i] = normal.x; NormY[i] = normal.y; NormZ[i] = normal.z;
+    }
+
+    // copies position and normal of the i-th vertex back in the array of Vertex structures
+    void Store(vector<Vertex>& vertices, GLuint i) const
+    {
+        vertices[i].Position = this->Position(i);
+        vertices[i].Normal = this->Normal(i);
+    }
+
+    //////////////////////////////////////////
+
+    // compares the positions with an interleaved array of (position, normal) pairs, like the one captured by transform feedback.
+    // The indices of the vertices with a different position are added to "changed". It returns the number of changed vertices.
+    int FindChanged(const glm::vec3* data, vector<GLuint>& changed) const
+    {
+        GLuint n = this->Size();
+        GLuint i = 0;
+        changed.clear();
+
+#if SIMD_WIDTH > 1
+        const float* d = &data[0].x;
+        for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+        {
+            const float* block = d + i*6;
+            simd_float diff = simd_cmpneq(simd_load(&PosX[i]), simd_load_interleaved(block));
+            diff = simd_or(diff, simd_cmpneq(simd_load(&PosY[i]), simd_load_interleaved(block + 1)));
+            diff = simd_or(diff, simd_cmpneq(simd_load(&PosZ[i]), simd_load_interleaved(block + 2)));
+            int mask = simd_movemask(diff);
+            // most of the blocks are untouched by the impact: we skip them with a single test
+            for (int lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                if (mask & 1)
+                    changed.push_back(i + lane);
+            }
+        }
+#endif
+        // scalar fallback (and remaining vertices)
+        for (; i < n; i++)
+        {
+            if (PosX[i] != data[i*2].x || PosY[i] != data[i*2].y || PosZ[i] != data[i*2].z)
+                changed.push_back(i);
+        }
+        return changed.size();
+    }
+};
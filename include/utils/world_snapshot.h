@@ -0,0 +1,280 @@
+/*
+WorldSnapshot class
+- binary snapshot of the state of the rigid bodies of a Bullet world, written with btDefaultSerializer (the same .bullet format of btDynamicsWorld::serialize):
+  the collision shapes used by the bodies, and, for each body, transforms, velocities, activation state and deactivation time
+- the snapshot is restored in place: the chunks of the bodies are read back in the order of the collision objects array of the world,
+  and copied into the existing bodies, so no shape or body is created, and the models are not loaded again
+- bodies in the excluded collision filter group are not saved (e.g., the projectiles, which are added and removed from the world by the pool
+  during the simulation: they are retired when the snapshot is restored, see Physics::RestoreSnapshot)
+- the snapshot can be saved to a file, and loaded again by the same build of the application (same precision and pointer size)
+
+The bodies of the scene must be the same, and created in the same order, of the world that has been saved: mass and shape type of each body are checked,
+and the restore is stopped if they do not match.
+N.B.) the shapes are saved to keep the snapshot readable by btBulletWorldImporter, but they are not restored (the shapes of the scene do not change)
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+#include <bullet/btBulletDynamicsCommon.h>
+#include <bullet/LinearMath/btSerializer.h>
+
+/////////////////// WORLD SNAPSHOT class ///////////////////////
+class WorldSnapshot
+{
+public:
+    //////////////////////////////////////////
+
+    // the state of the bodies of the world (except the ones in the excluded filter group) is saved, and it replaces the previous snapshot.
+    // It returns the number of saved bodies
+    int Capture(btDiscreteDynamicsWorld* world, int excludedGroup = 0)
+    {
+        vector<btRigidBody*> bodies;
+        WorldSnapshot::sceneBodies(world, excludedGroup, bodies);
+
+        // the BVH of the triangle meshes can be rebuilt from the mesh data: it is not saved, to keep the snapshot compact
+        btDefaultSerializer serializer;
+        serializer.setSerializationFlags(BT_SERIALIZE_NO_BVH | BT_SERIALIZE_NO_TRIANGLEINFOMAP);
+        serializer.startSerialization();
+
+        // each shared shape is saved once
+        btHashMap<btHashPtr, btCollisionShape*> savedShapes;
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            btCollisionShape* shape = bodies[i]->getCollisionShape();
+            if (!savedShapes.find(shape))
+            {
+                savedShapes.insert(shape, shape);
+                shape->serializeSingleShape(&serializer);
+            }
+        }
+        for (size_t i = 0; i < bodies.size(); i++)
+            bodies[i]->serializeSingleObject(&serializer);
+
+        serializer.finishSerialization();
+
+        const unsigned char* buffer = serializer.getBufferPointer();
+        this->data.assign(buffer, buffer + serializer.getCurrentBufferSize());
+        this->numBodies = bodies.size();
+        return this->numBodies;
+    }
+
+    // the saved state is copied into the bodies of the world. It returns false if the snapshot does not match the bodies of the world
+    bool Restore(btDiscreteDynamicsWorld* world, int excludedGroup = 0) const
+    {
+        if (!this->valid())
+        {
+            cout << "ERROR::SNAPSHOT:: the snapshot is empty, or it has been saved by a different build" << endl;
+            return false;
+        }
+
+        // chunks of the bodies, in the order of the world
+        vector<const btRigidBodyData*> states;
+        vector<int> shapeTypes;
+        this->readChunks(states, shapeTypes);
+
+        vector<btRigidBody*> bodies;
+        WorldSnapshot::sceneBodies(world, excludedGroup, bodies);
+        if (bodies.size() != states.size())
+        {
+            cout << "ERROR::SNAPSHOT:: the snapshot has " << states.size() << " bodies, the world has " << bodies.size() << endl;
+            return false;
+        }
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            if (bodies[i]->getInvMass() != states[i]->m_inverseMass || bodies[i]->getCollisionShape()->getShapeType() != shapeTypes[i])
+            {
+                cout << "ERROR::SNAPSHOT:: body " << i << " does not match the snapshot" << endl;
+                return false;
+            }
+        }
+
+        btOverlappingPairCache* pairs = world->getBroadphase()->getOverlappingPairCache();
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            btRigidBody* body = bodies[i];
+            const btCollisionObjectData& object = states[i]->m_collisionObjectData;
+
+            btTransform transform, interpolationTransform;
+            transform.deSerialize(object.m_worldTransform);
+            interpolationTransform.deSerialize(object.m_interpolationWorldTransform);
+            body->setWorldTransform(transform);
+            body->setInterpolationWorldTransform(interpolationTransform);
+            if (body->getMotionState())
+                body->getMotionState()->setWorldTransform(transform);
+
+            btVector3 v;
+            v.deSerialize(states[i]->m_linearVelocity);
+            body->setLinearVelocity(v);
+            v.deSerialize(states[i]->m_angularVelocity);
+            body->setAngularVelocity(v);
+            v.deSerialize(object.m_interpolationLinearVelocity);
+            body->setInterpolationLinearVelocity(v);
+            v.deSerialize(object.m_interpolationAngularVelocity);
+            body->setInterpolationAngularVelocity(v);
+            body->clearForces();
+
+            body->forceActivationState(object.m_activationState1);
+            body->setDeactivationTime(object.m_deactivationTime);
+            body->setHitFraction(object.m_hitFraction);
+
+            // the contacts computed at the old positions are not valid anymore
+            if (body->getBroadphaseHandle())
+            {
+                pairs->cleanProxyFromPairs(body->getBroadphaseHandle(), world->getDispatcher());
+                world->updateSingleAabb(body);
+            }
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // the snapshot is written to a binary file
+    bool Save(const string& path) const
+    {
+        ofstream file(path.c_str(), ios::binary);
+        if (!file || this->data.empty())
+        {
+            cout << "ERROR::SNAPSHOT:: cannot write " << path << endl;
+            return false;
+        }
+        file.write((const char*)&this->data[0], this->data.size());
+        return file.good();
+    }
+
+    // the snapshot is read from a binary file written by Save
+    bool Load(const string& path)
+    {
+        ifstream file(path.c_str(), ios::binary | ios::ate);
+        if (!file)
+        {
+            cout << "ERROR::SNAPSHOT:: cannot read " << path << endl;
+            return false;
+        }
+        streamsize size = file.tellg();
+        file.seekg(0, ios::beg);
+        this->data.resize(size);
+        if (size > 0)
+            file.read((char*)&this->data[0], size);
+
+        if (!file.good() || !this->valid())
+        {
+            cout << "ERROR::SNAPSHOT:: " << path << " is not a snapshot of this build" << endl;
+            this->data.clear();
+            this->numBodies = 0;
+            return false;
+        }
+        vector<const btRigidBodyData*> states;
+        vector<int> shapeTypes;
+        this->readChunks(states, shapeTypes);
+        this->numBodies = states.size();
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // number of saved bodies
+    int Bodies() const
+    {
+        return this->numBodies;
+    }
+
+    // size of the snapshot (in bytes)
+    size_t Size() const
+    {
+        return this->data.size();
+    }
+
+    bool Empty() const
+    {
+        return this->data.empty();
+    }
+
+    //////////////////////////////////////////
+    // Constructor
+    WorldSnapshot()
+    {
+        this->numBodies = 0;
+    }
+
+private:
+    // serialized data (header, chunks, DNA)
+    vector<unsigned char> data;
+    int numBodies;
+
+    //////////////////////////////////////////
+
+    // rigid bodies of the world which are not in the excluded filter group, in the order of the collision objects array
+    static void sceneBodies(btDiscreteDynamicsWorld* world, int excludedGroup, vector<btRigidBody*>& bodies)
+    {
+        const btCollisionObjectArray& objects = world->getCollisionObjectArray();
+        for (int i = 0; i < objects.size(); i++)
+        {
+            btRigidBody* body = btRigidBody::upcast(objects[i]);
+            if (body == NULL)
+                continue;
+            if (body->getBroadphaseHandle() && (body->getBroadphaseHandle()->m_collisionFilterGroup & excludedGroup))
+                continue;
+            bodies.push_back(body);
+        }
+    }
+
+    // the data have been written by this build: same header (precision, pointer size, endianness, version)
+    bool valid() const
+    {
+        if (this->data.size() < BT_HEADER_LENGTH)
+            return false;
+        unsigned char header[BT_HEADER_LENGTH];
+        btDefaultSerializer serializer;
+        serializer.writeHeader(header);
+        return memcmp(header, &this->data[0], BT_HEADER_LENGTH) == 0;
+    }
+
+    // the chunks of the bodies (in the order they were saved), and the types of their shapes.
+    // The pointers stored in the chunks are unique ids, so each body is matched to its shape through the m_oldPtr field of the shape chunks
+    void readChunks(vector<const btRigidBodyData*>& states, vector<int>& shapeTypes) const
+    {
+        vector<void*> shapeIds;
+        vector<int> types;
+
+        size_t offset = BT_HEADER_LENGTH;
+        while (offset + sizeof(btChunk) <= this->data.size())
+        {
+            const btChunk* chunk = (const btChunk*)&this->data[offset];
+            const unsigned char* payload = &this->data[offset + sizeof(btChunk)];
+            if (chunk->m_length < 0 || offset + sizeof(btChunk) + chunk->m_length > this->data.size())
+                break;
+
+            if (chunk->m_chunkCode == BT_SHAPE_CODE)
+            {
+                shapeIds.push_back(chunk->m_oldPtr);
+                types.push_back(((const btCollisionShapeData*)payload)->m_shapeType);
+            }
+            else if (chunk->m_chunkCode == BT_RIGIDBODY_CODE)
+            {
+                const btRigidBodyData* state = (const btRigidBodyData*)payload;
+                states.push_back(state);
+                int type = -1;
+                for (size_t i = 0; i < shapeIds.size(); i++)
+                {
+                    if (shapeIds[i] == state->m_collisionObjectData.m_collisionShape)
+                        type = types[i];
+                }
+                shapeTypes.push_back(type);
+            }
+            // the DNA is the last chunk
+            else if (chunk->m_chunkCode == BT_DNA_CODE)
+                break;
+            offset += sizeof(btChunk) + chunk->m_length;
+        }
+    }
+};
@@ -10,7 +10,13 @@
 #include <utils/shader_fee.h>
 #include <utils/camera.h>
 #include <utils/model_v2.h>
+#include <utils/asset_registry.h>
+#include <utils/asset_loader.h>
 #include <utils/physics.h>
+#include <utils/physics_thread.h>
+#include <utils/deformation.h>
+#include <utils/impact_queue.h>
+#include <utils/feedback_batch.h>
 #include <vector>
 
 #include <bullet/btBulletDynamicsCommon.h>
@@ -33,6 +39,13 @@ struct Character {
     GLuint     Advance;    // Offset to advance to next glyph
 };
 
+// glyph rasterized by FreeType on a worker of the asset loader, before the creation of its texture
+struct GlyphBitmap {
+    GLchar Code;
+    vector<unsigned char> Pixels;
+    Character Metrics;
+};
+
 std::map<GLchar, Character> Characters;
 GLuint VAO, VBO;
 void RenderText(Shader &shader, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color);
@@ -45,11 +58,9 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 // if one of the WASD keys is pressed, we call the corresponding method of the Camera class
 void apply_camera_movements();
 float getDistance(glm::vec3 point1, glm::vec3 point2);
-glm::vec3 checkCollisions();
 void updateMeshes();
-unsigned int loadTexture(const char *path);
-int getHitModel(glm::vec3 hitPoint, glm::vec3* cubes_pos, glm::vec3* cubes_size);
-unsigned int loadCubemap(vector<std::string> faces);
+// the glyphs of the font are rasterized by a worker of the loader, and their textures are created when the loader is finished
+void loadGlyphs(AssetLoader& loader, const string& font, int pixelSize);
 
 // settings
 const unsigned int SCR_WIDTH = 1366;
@@ -69,8 +80,30 @@ double cursorX, cursorY;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-// Bullet simulation
-Physics bulletSimulation;
+// Bullet simulation (created in main): with many bullets in the scene, the simulation islands are solved in parallel
+Physics* bulletSimulation = NULL;
+// the simulation is stepped at a fixed rate on its own thread; the render loop locks the world only to process impacts and bullets
+PhysicsThread* physicsThread = NULL;
+// interpolated transforms of the bullets, for the current frame
+vector<BodyTransform> bulletTransforms;
+// state of the bodies of the scene, saved when the simulation starts (or with K): R moves the bodies back to it, without building the scene again
+// (the deformations of the models are not part of the snapshot)
+WorldSnapshot sceneSnapshot;
+
+// impact model (shared by the transform feedback pass and by the CPU implementation)
+DeformationEngine deformer;
+
+// asynchronous readback of the deformed vertices from the GPU
+AsyncReadback readback;
+
+// new contact points found after each simulation step, waiting to be applied to the deformable objects
+ImpactQueue impacts;
+// maximum number of impacts processed in a frame, and array for the impacts of the current batch
+const GLuint IMPACT_BATCH = 32;
+ImpactEvent impactBatch[IMPACT_BATCH];
+
+// transform feedback deformation of all the models hit in a frame, with a single draw call
+FeedbackBatch feedbackBatch(IMPACT_BATCH);
 
 // we initialize an array of booleans for each keybord key
 bool keys[1024];
@@ -81,6 +114,17 @@ glm::mat4 view, projection;
 // boolean to activate/deactivate wireframe rendering
 GLboolean wireframe = GL_FALSE;
 
+// boolean to switch between the transform feedback deformation (GPU) and the SIMD implementation of the DeformationEngine class (CPU)
+GLboolean cpuDeformation = GL_FALSE;
+
+// boolean to keep positions and normals of the deformable objects on the GPU: transform feedback writes in ping-pong buffers used directly for rendering,
+// and data are read back only when the mode is disabled
+GLboolean gpuDeformation = GL_FALSE;
+
+// boolean to use, for the deformable objects, triangle mesh collision shapes built on the vertices of the models (refit after each impact),
+// instead of boxes and spheres: bullets collide with the deformed surfaces. It is used only when the objects are created
+GLboolean meshColliders = GL_TRUE;
+
 // Uniforms to be passed to shaders
 // point light position
 glm::vec3 lightPos0 = glm::vec3(5.0f, 10.0f, 10.0f);
@@ -100,10 +144,7 @@ GLfloat planeMaterial[] = {0.0,0.5,0.0};
 // color of the bullets
 GLfloat shootColor[] = {1.0,1.0,0.0};
 
-glm::vec3 verticesToDeform[600];
-glm::vec3 hittingDirections[600];
 int sphereDirCooldown = 0;
-int index_vtd = 0;
 
 // Lighting
 glm::vec3 pointLightPositions[] = {
@@ -132,8 +173,6 @@ int flashlightCooldown;
 bool shooting;
 int shootingCooldown;
 
-glm::vec3 contactPoint1, contactPoint2;
-
 // dimensions and position of the static plane
 glm::vec3 plane_pos = glm::vec3(0.0f, -1.0f, 0.0f);
 glm::vec3 plane_size = glm::vec3(50.0f, 0.1f, 50.0f);
@@ -152,6 +191,11 @@ glm::vec3 cube_size = glm::vec3(2.5f, 2.5f, 2.5f);
 // we set a small initial rotation for the cubes
 glm::vec3 cube_rot = glm::vec3(0.0f, 0.0f, 0.0f);
 
+// bullets are taken from a pool (see Physics::CreateProjectilePool): they are removed after projectileLifetime seconds (or when they stop),
+// and at most maxProjectiles bullets are in the scene
+GLfloat projectileLifetime = 10.0f;
+GLint maxProjectiles = 256;
+
 // dimension of the bullets
 glm::vec3 sphere_size = glm::vec3(0.1f, 0.1f, 0.1f);
 
@@ -160,7 +204,6 @@ glm::vec3 radius = glm::vec3(2.5f, 2.5f, 2.5f);
 // float mass = 9999999.0f;
 float mass = 0.0f;  // static
 
-bool hit;
 bool first;
 
 int main()
@@ -226,62 +269,12 @@ int main()
     shader.use();
     glUniformMatrix4fv(glGetUniformLocation(shader.ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
     
-    FT_Library ft;
-    if (FT_Init_FreeType(&ft))
-        std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
-
-    FT_Face face;
-    if (FT_New_Face(ft, "..\\..\\..\\fonts\\segoepr.ttf", 0, &face))
-        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl; 
-        
-    FT_Set_Pixel_Sizes(face, 0, 48);  
-    
-    if (FT_Load_Char(face, 'X', FT_LOAD_RENDER))
-        std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl; 
-
+    // the assets are loaded in parallel: files are parsed and images decoded by the workers of the loader, and uploaded
+    // to the GPU by this thread when the loader is finished (see below)
+    AssetLoader loader;
+    loadGlyphs(loader, "..\\..\\..\\fonts\\segoepr.ttf", 48);
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Disable byte-alignment restriction
-      
-    for (GLubyte c = 0; c < 128; c++)
-    {
-        // Load character glyph 
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
-        {
-            std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
-            continue;
-        }
-        // Generate texture
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(
-            GL_TEXTURE_2D,
-            0,
-            GL_RED,
-            face->glyph->bitmap.width,
-            face->glyph->bitmap.rows,
-            0,
-            GL_RED,
-            GL_UNSIGNED_BYTE,
-            face->glyph->bitmap.buffer
-        );
-        // Set texture options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        // Now store character for later use
-        Character character = {
-            texture, 
-            glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-            glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-            face->glyph->advance.x
-        };
-        Characters.insert(std::pair<GLchar, Character>(c, character));
-    }
-    
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
     
     // Configure VAO/VBO for texture quads
     glGenVertexArrays(1, &VAO);
@@ -352,12 +345,6 @@ int main()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
     
-    // Initialize verticesToDeform
-    for (int i = 0; i<100; i++)
-    {
-        verticesToDeform[i] = glm::vec3(0.0f);
-    }
-    
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
@@ -368,6 +355,7 @@ int main()
     Shader object_shader("..\\shaders\\13_phong.vert", "..\\shaders\\14_ggx.frag");
     Shader deformShader("..\\shaders\\shaderNM.VERT", "..\\shaders\\shaderNM.FRAG");   
     ShaderFee feedbackShader("..\\shaders\\feedback.VERT");
+    ShaderFee feedbackBatchShader("..\\shaders\\feedbackBatch.VERT");
     Shader skyboxShader("..\\shaders\\skyboxV.VERT", "..\\shaders\\skyboxF.FRAG");
     
     vector<std::string> faces
@@ -380,34 +368,67 @@ int main()
         "..\\resources\\skybox\\back.jpg"
     };
     
-    unsigned int cubemapTexture = loadCubemap(faces);
+    GLuint cubemapTexture;
+    loader.LoadCubemap(faces, &cubemapTexture);
 
     // load models
     // -----------
-    Model cubeModel("..\\..\\..\\models\\cube2\\cube.obj");
-    Model planeModel("..\\..\\..\\models\\cube2\\cube.obj");
-    Model sphereModel("..\\..\\..\\models\\sphere.obj", 1);
+    // each model file is loaded once: the deformable objects are instances of the loaded models, and they copy the vertices only when hit
+    AssetRegistry assets;
+    Model* highCubeAsset = assets.Load("..\\..\\..\\models\\cube2\\highCube.obj", loader);
+    Model* cubeAsset = assets.Load("..\\..\\..\\models\\cube2\\cube.obj", loader);
+    Model* veryHighSphereAsset = assets.Load("..\\..\\..\\models\\sphere\\veryHighSphere.obj", loader);
+    Model* sphereAsset = assets.Load("..\\..\\..\\models\\sphere\\sphere.obj", loader);
+    Model* bulletAsset = assets.Load("..\\..\\..\\models\\sphere.obj", loader);
+
+    // load textures
+    // -------------
+    GLuint normalMap, displacementMap, cubeTexture, floorTexture;
+    loader.LoadTexture("..\\..\\..\\models\\cube2\\normalMap.png", &normalMap);
+    loader.LoadTexture("..\\..\\..\\models\\cube2\\displacementMap2.png", &displacementMap);
+    loader.LoadTexture("..\\..\\..\\textures\\high\\4k.jpg", &cubeTexture);
+    loader.LoadTexture("..\\..\\..\\textures\\ground_mud.jpg", &floorTexture);
+
+    // all the queued assets are loaded: the instances of the models can be created after this point
+    double loadStart = glfwGetTime();
+    int loadJobs = loader.Finish();
+    cout << loadJobs << " loading jobs finished in " << (glfwGetTime() - loadStart) << " s" << endl;
+    
+    Model cubeModel(cubeAsset);
+    Model planeModel(cubeAsset);
+    Model sphereModel(bulletAsset, 1);
     
     Model cubes[total_cubes] = { 
                                 // ITEMS
-                                Model("..\\..\\..\\models\\cube2\\highCube.obj"),
-                                Model("..\\..\\..\\models\\cube2\\highCube.obj"),
-                                Model("..\\..\\..\\models\\cube2\\highCube.obj"),
-                                Model("..\\..\\..\\models\\cube2\\cube.obj"),
-                                Model("..\\..\\..\\models\\cube2\\cube.obj"),
-                                Model("..\\..\\..\\models\\cube2\\cube.obj"),
-                                Model("..\\..\\..\\models\\sphere\\veryHighSphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\veryHighSphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\veryHighSphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\veryHighSphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\veryHighSphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\sphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\sphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\sphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\sphere.obj", 1),
-                                Model("..\\..\\..\\models\\sphere\\sphere.obj", 1)
+                                Model(highCubeAsset),
+                                Model(highCubeAsset),
+                                Model(highCubeAsset),
+                                Model(cubeAsset),
+                                Model(cubeAsset),
+                                Model(cubeAsset),
+                                Model(veryHighSphereAsset, 1),
+                                Model(veryHighSphereAsset, 1),
+                                Model(veryHighSphereAsset, 1),
+                                Model(veryHighSphereAsset, 1),
+                                Model(veryHighSphereAsset, 1),
+                                Model(sphereAsset, 1),
+                                Model(sphereAsset, 1),
+                                Model(sphereAsset, 1),
+                                Model(sphereAsset, 1),
+                                Model(sphereAsset, 1)
                                 };
                        
+    // Bullet simulation: the islands are solved in parallel by the cores not used by the render thread and by the physics thread
+    // (with 1 thread, a single-threaded world is used). The pool is joined when the simulation is destroyed, at the end of main
+    int physicsThreads = ThreadPool::HardwareThreads() - 2;
+    Physics simulation(physicsThreads > 1 ? physicsThreads : 1);
+    PhysicsThread simulationThread(simulation.dynamicsWorld);
+    bulletSimulation = &simulation;
+    physicsThread = &simulationThread;
+    // the readbacks apply the deformed vertices to the models, and refit their colliders: their callbacks run with the world locked,
+    // while the waits for the GPU are done without the lock
+    readback.SetCallbackLock([]() { physicsThread->Lock(); }, []() { physicsThread->Unlock(); });
+
     glm::vec3 cubes_pos[total_cubes];
     glm::vec3 cubes_size[total_cubes];
     
@@ -418,7 +439,7 @@ int main()
     {
         for (int j = 0; j<2; j++)
         {
-            btRigidBody* plane = bulletSimulation.createRigidBody(BOX, glm::vec3(plane_pos.x - xoff, plane_pos.y, plane_pos.z + zoff), plane_size, plane_rot, 0.0f, 0.3f, 0.3f);
+            btRigidBody* plane = bulletSimulation->createRigidBody(BOX, glm::vec3(plane_pos.x - xoff, plane_pos.y, plane_pos.z + zoff), plane_size, plane_rot, 0.0f, 0.3f, 0.3f);
             xoff += 100;
         }
         xoff = 0;
@@ -434,29 +455,29 @@ int main()
             cubes_pos[cnt] = glm::vec3((i - num_side)*15, 1.6f, (num_side - j)*15);
             cubes_size[cnt] = cube_size;
                 
-            if (cubes[cnt].type == 1)
-                cube = bulletSimulation.createRigidBody(SPHERE, cubes_pos[cnt], radius, cube_rot, mass, 0.3f, 0.3f);
+            // the deformable objects collide only with the bullets
+            int group = DEFORMABLE_GROUP | btBroadphaseProxy::StaticFilter;
+            if (meshColliders)
+                cube = bulletSimulation->createRigidBody(cubes[cnt].EnableCollider(cubes_size[cnt]), cubes_pos[cnt], cube_rot, mass, 0.3f, 0.3f, group, PROJECTILE_GROUP);
+            else if (cubes[cnt].type == 1)
+                cube = bulletSimulation->createRigidBody(SPHERE, cubes_pos[cnt], radius, cube_rot, mass, 0.3f, 0.3f, group, PROJECTILE_GROUP);
             else
-                cube = bulletSimulation.createRigidBody(BOX, cubes_pos[cnt], radius, cube_rot, mass, 0.3f, 0.3f);
+                cube = bulletSimulation->createRigidBody(BOX, cubes_pos[cnt], radius, cube_rot, mass, 0.3f, 0.3f, group, PROJECTILE_GROUP);
+            // Bullet reports the new contacts of the object to the impact queue
+            impacts.Watch(cube);
+            // the body keeps a reference to its model, so an impact is assigned directly to the hit model
+            cube->setUserPointer(&cubes[cnt]);
+            cube->setUserIndex(cnt);
             cnt++;
         }
     }
+    
+    // the bullets are spheres with mass = 1
+    bulletSimulation->CreateProjectilePool(sphere_size.x, 1.0f, 0.3f, 0.3f, projectileLifetime, maxProjectiles, physicsThread->timeStep);
 
     // Projection matrix: FOV angle, aspect ratio, near and far planes
     projection = glm::perspective(45.0f, (float)SCR_WIDTH/(float)SCR_HEIGHT, 0.1f, 100000.0f);
 
-    GLfloat maxSecPerFrame = 60.0f;
-    
-    // load textures (we now use a utility function to keep the code more organized)
-    // -----------------------------------------------------------------------------
-    unsigned int normalMap = loadTexture("..\\..\\..\\models\\cube2\\normalMap.png");
-    unsigned int displacementMap = loadTexture("..\\..\\..\\models\\cube2\\displacementMap2.png");
-    
-    // load textures
-    // -------------
-    unsigned int cubeTexture = loadTexture("..\\..\\..\\textures\\high\\4k.jpg");
-    unsigned int floorTexture = loadTexture("..\\..\\..\\textures\\ground_mud.jpg");
-    
     // framebuffer configuration
     // -------------------------
     unsigned int framebuffer;
@@ -481,16 +502,6 @@ int main()
         cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << endl;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    GLuint vbo;
-    GLuint tbo;
-
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &tbo);
-    
     char fps[100];
     char* fps_text = "FPS: ";
     std::string fps_num;
@@ -498,6 +509,11 @@ int main()
     double startTime = glfwGetTime();
     int nbFrames = 0;
     
+    // the new contacts between deformable objects and bullets are recorded by the contact callback of Bullet, during the steps of the simulation
+    impacts.Listen(bulletSimulation->dynamicsWorld, DEFORMABLE_GROUP, PROJECTILE_GROUP);
+    bulletSimulation->SaveSnapshot(sceneSnapshot);
+    physicsThread->Start(glfwGetTime());
+    
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window))
@@ -541,6 +557,25 @@ int main()
         
         view = camera.GetViewMatrix();
 
+        // transient buffers of the previous frame are released
+        FrameArena::Frame().Reset();
+
+        // the deformed vertices copied from the GPU in the previous frames are applied to the models
+        // (the world is locked by the readback only while the vertices are applied, see SetCallbackLock)
+        readback.Poll();
+
+        // the deformation mode has been changed (P key): data of the deformable objects are moved between CPU and GPU
+        if ((bool)gpuDeformation != cubes[0].GpuResident())
+        {
+            // pending readbacks are older than the data on the GPU, so they must be applied before
+            readback.Flush();
+            // the vertices (and the colliders) of the models are changed: the physics thread must not read them
+            physicsThread->Lock();
+            for (int i = 0; i < total_cubes; i++)
+                cubes[i].SetGpuResident(gpuDeformation);
+            physicsThread->Unlock();
+        }
+
         // render
         // ------
         
@@ -550,101 +585,87 @@ int main()
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
         else
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            
-        bulletSimulation.dynamicsWorld->stepSimulation((deltaTime < maxSecPerFrame ? deltaTime : maxSecPerFrame), 0);
         
         //////////////////////////    PRE - RENDER SCENE    //////////////////////////
         
-        // 1 - Check whether there are new collision points. If yes, store them and their respective directions.
-        
-        glm::vec3 hitPoint = checkCollisions();
+        // 1 - The new collision points between deformable objects and bullets are added to the impact queue by the physics thread (see ImpactQueue::Listen)
         
-        // 2 - Update the vertices by capturing them as feedback
+        // 2 - Update the vertices of the hit models (all the impacts in the queue are processed, in batches of IMPACT_BATCH impacts per frame).
+        //     The world is locked only while the vertices of a model, and its collider, are changed on this thread
         
-        if (hit)
+        // the queue is filled by the physics thread during the steps
+        physicsThread->Lock();
+        GLuint numImpacts = impacts.Pop(impactBatch, IMPACT_BATCH);
+        physicsThread->Unlock();
+        for (GLuint e = 0; e < numImpacts; e++)
         {
+            // the queue contains only impacts between a deformable object (static) and a bullet (dynamic)
             if (first)
                 first = false;
             
-            int hitModel = getHitModel(hitPoint, cubes_pos, cubes_size);
-      
-            int ind = 0;
-            int dim = 0;
-            
-            for (int i = 0; i<cubes[hitModel].meshes.size(); i++)
-                dim += cubes[hitModel].meshes[i].vertices.size();
-
-            glm::vec3 data[dim*2];
+            glm::vec3 hitPoint = impactBatch[e].Point;
+            // the normal points towards body A: the direction of the impact goes inside the static object
+            bool staticA = impactBatch[e].BodyA->isStaticObject();
+            glm::vec3 hitDirection = staticA ? impactBatch[e].Normal : -impactBatch[e].Normal;
+            // index of the hit model, stored in its body (see the creation of the deformable objects)
+            int hitModel = (staticA ? impactBatch[e].BodyA : impactBatch[e].BodyB)->getUserIndex();
+            if (hitModel < 0)
+                continue;
             
-            for (int i = 0; i<cubes[hitModel].meshes.size(); i++)
-            {
-                for(int j=0; j<cubes[hitModel].meshes[i].vertices.size(); j++)
-                {
-                    data[ind++] = glm::vec3(cubes[hitModel].meshes[i].vertices[j].Position.x,
-                        cubes[hitModel].meshes[i].vertices[j].Position.y, cubes[hitModel].meshes[i].vertices[j].Position.z);
-                    data[ind++] = glm::vec3(cubes[hitModel].meshes[i].vertices[j].Normal.x,
-                        cubes[hitModel].meshes[i].vertices[j].Normal.y, cubes[hitModel].meshes[i].vertices[j].Normal.z);
-                }
-            }
-        
             glm::mat4 model;
             model = glm::translate(model, cubes_pos[hitModel]);
             model = glm::scale(model, cube_size);
-                
-            glBindVertexArray(vao);
-            
-            feedbackShader.use();
-            feedbackShader.setMat4("model", model);
-            feedbackShader.setMat4("view", view);
-            feedbackShader.setMat4("projection", projection);
-            feedbackShader.setVec3("hitPoint", hitPoint);
-            feedbackShader.setVec3("hitDirection", camera.Front);
-            
-//            printf("HITPOINT: %f %f %f\n", hitPoint.x, hitPoint.y, hitPoint.z);
-                    
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-
-            GLint inputAttrib = glGetAttribLocation(feedbackShader.ID, "position");
-            glEnableVertexAttribArray(inputAttrib);
-            glVertexAttribPointer(inputAttrib, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)0);
-            GLint inputAttrib2 = glGetAttribLocation(feedbackShader.ID, "normal");
-            glEnableVertexAttribArray(inputAttrib2);
-            glVertexAttribPointer(inputAttrib2, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)(sizeof(glm::vec3)));
             
-            glm::vec3 feedback[dim*2];
-
-            // Create transform feedback buffer
-            glBindBuffer(GL_ARRAY_BUFFER, tbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(feedback), nullptr, GL_STATIC_READ);
-
-            // Perform feedback transform
-            glEnable(GL_RASTERIZER_DISCARD);
+            // a model can be in the batch only once, and the batch has a maximum size: in these cases, the current batch is processed before
+            if (!gpuDeformation && !cpuDeformation && (feedbackBatch.Full() || feedbackBatch.Contains(&cubes[hitModel])))
+                feedbackBatch.Dispatch(feedbackBatchShader, deformer, readback);
 
-            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tbo);
+            // on the CPU, the impact must start from the current positions: if the results of a previous impact on the same model are still on the GPU, we wait for them
+            if (!gpuDeformation && cubes[hitModel].pendingReadbacks > 0)
+                readback.Flush();
 
-            glBeginTransformFeedback(GL_POINTS);
-                glDrawArrays(GL_POINTS, 0, sizeof(feedback));
-            glEndTransformFeedback();
-
-            glDisable(GL_RASTERIZER_DISCARD);
-
-            glFlush();
-
-            // Fetch and print results
-            glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, sizeof(feedback), feedback);
-            
-            int j = 0;
-            for(int i = 0; i<dim*2; i+=2)
+            if (gpuDeformation)
             {
-                j = i/2;
-                
-                data[i] = feedback[i];
-                data[i+1] = feedback[i+1];
+                // all the vertices of the model are processed by transform feedback, and the results stay on the GPU
+                feedbackShader.use();
+                feedbackShader.setMat4("model", model);
+                feedbackShader.setVec3("hitPoint", hitPoint);
+                feedbackShader.setVec3("hitDirection", hitDirection);
+                feedbackShader.setFloat("range", deformer.range);
+                feedbackShader.setFloat("power", deformer.power);
+                feedbackShader.setFloat("max_magnitude", deformer.max_magnitude);
+                // on the first impact, a shared instance gets its own copy of the meshes and rebinds its collider: the physics thread must not read it
+                physicsThread->Lock();
+                cubes[hitModel].DeformOnGpu();
+                physicsThread->Unlock();
+                // the CPU copy is read back in the next frames only to refit the collider of the model (with a collider);
+                // the spatial hash and the CPU deformation use the copy read when the deformation mode changes (see SetGpuResident)
+                cubes[hitModel].RequestReadBack(readback);
+            }
+            else if (cpuDeformation)
+            {
+                // the vertices near the hit point are deformed on the CPU, and only the meshes with moved vertices are sent to the GPU
+                Impact impact = {hitPoint, hitDirection};
+                physicsThread->Lock();
+                cubes[hitModel].Deform(deformer, model, impact);
+                physicsThread->Unlock();
+            }
+            else
+            {
+                // only the vertices that can be reached by the impact (found using the spatial hash of the model) are added to the batch of the frame,
+                // which is processed by transform feedback with a single draw call
+                Impact impact = {hitPoint, hitDirection};
+                feedbackBatch.Add(cubes[hitModel], model, impact, deformer.range);
             }
-            
-            cubes[hitModel].UpdateData(data);
         }
+
+        // the vertices of all the models hit in this frame are deformed, and the results are read asynchronously
+        feedbackBatch.Dispatch(feedbackBatchShader, deformer, readback);
+        
+        // old and stopped bullets are removed from the scene
+        physicsThread->Lock();
+        bulletSimulation->projectiles->Update(currentFrame);
+        physicsThread->Unlock();
         
         // 3 - Render the scene
         
@@ -801,21 +822,15 @@ int main()
         }
 
 
-        int num_cobjs = bulletSimulation.dynamicsWorld->getNumCollisionObjects();
         int ind = 0;
 
-        for(int i = 1; i < num_cobjs; i++ )
+        // the bullets (the only dynamic bodies) are rendered in the state interpolated between the last two steps of the simulation
+        physicsThread->Interpolate(glfwGetTime(), bulletTransforms);
+        for(GLuint i = 0; i < bulletTransforms.size(); i++ )
         {
-            if (i <= total_cubes)
-            {
-                continue;
-            }
-            else
-            {
-                objectModel = &sphereModel;
-                objectShader = &object_shader;
-                obj_size = sphere_size;
-            }
+            objectModel = &sphereModel;
+            objectShader = &object_shader;
+            obj_size = sphere_size;
             
             objectShader->use();
             GLint objDiffuseLocation = glGetUniformLocation(objectShader->ID, "diffuseColor");
@@ -824,9 +839,7 @@ int main()
             glUniformMatrix4fv(glGetUniformLocation(objectShader->ID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
             glUniformMatrix4fv(glGetUniformLocation(objectShader->ID, "view"), 1, GL_FALSE, glm::value_ptr(view));
         
-            btCollisionObject* obj = bulletSimulation.dynamicsWorld->getCollisionObjectArray()[i];
-            btRigidBody* body = btRigidBody::upcast(obj);
-            body->getMotionState()->getWorldTransform(transform);
+            transform = bulletTransforms[i].Transform;
             transform.getOpenGLMatrix(matrix);
             
             objModelMatrix = glm::make_mat4(matrix)*glm::scale(objModelMatrix, obj_size);
@@ -860,15 +873,10 @@ int main()
         if (shooting && shootingCooldown == 0)
         {
             shootingCooldown = 15;
-            btVector3 pos, impulse;
-            glm::vec3 radius = glm::vec3(0.2f, 0.2f, 0.2f);
-            glm::vec3 rot = glm::vec3(0.0f, 0.0f, 0.0f);
             glm::vec4 shoot;
             GLfloat shootInitialSpeed = 30.0f;
-            btRigidBody* sphere;
             glm::mat4 unproject;
             
-            sphere = bulletSimulation.createRigidBody(SPHERE, camera.Position, sphere_size, rot, 1, 0.3f, 0.3f);
             shoot.x = camera.Front.x/SCR_WIDTH;
             shoot.y = camera.Front.y/SCR_HEIGHT;
             shoot.z = 1.0f;
@@ -880,12 +888,12 @@ int main()
             unproject = glm::inverse(projection*view);
             shoot = glm::normalize(unproject*shoot) * shootInitialSpeed;
             
-            impulse = btVector3(shoot.x, shoot.y, shoot.z);
-            sphere->applyCentralImpulse(impulse);
+            // a bullet is taken from the pool (no allocation after the first shots)
+            physicsThread->Lock();
+            bulletSimulation->projectiles->Fire(camera.Position, glm::vec3(shoot), currentFrame);
+            physicsThread->Unlock();
         }
         
-        hit = false;
-        
         strcpy(fps, fps_text);
         strcat(fps, fps_num.c_str());
         
@@ -898,6 +906,11 @@ int main()
 //        glfwPollEvents();
     }
 
+    // staging buffers of the asynchronous readback are deallocated
+    physicsThread->Stop();
+    readback.Delete();
+    feedbackBatch.Delete();
+
     glfwTerminate();
     return 0;
 }
@@ -915,6 +928,28 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if(key == GLFW_KEY_L && action == GLFW_PRESS)
         wireframe=!wireframe;
         
+    // if C is pressed, we switch between the GPU (transform feedback) and CPU deformation of the models
+    if(key == GLFW_KEY_C && action == GLFW_PRESS)
+        cpuDeformation=!cpuDeformation;
+
+    // if P is pressed, we keep the deformed data on the GPU (ping-pong transform feedback buffers)
+    if(key == GLFW_KEY_P && action == GLFW_PRESS)
+        gpuDeformation=!gpuDeformation;
+        
+    // if K is pressed, we save the current state of the scene; if R is pressed, we restore the saved state (and the bullets are removed)
+    if (key == GLFW_KEY_K && action == GLFW_PRESS)
+    {
+        physicsThread->Lock();
+        bulletSimulation->SaveSnapshot(sceneSnapshot);
+        physicsThread->Unlock();
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+    {
+        physicsThread->Lock();
+        bulletSimulation->RestoreSnapshot(sceneSnapshot);
+        physicsThread->Unlock();
+    }
+        
     // Press H to toggle the PointLights
     if (key == GLFW_KEY_H && action == GLFW_PRESS)
     {
@@ -1040,111 +1075,6 @@ float getDistance(glm::vec3 point1, glm::vec3 point2)
     return sqrt( pow(point1.x - point2.x, 2) + pow(point1.y - point2.y, 2) + pow(point1.z - point2.z, 2) );
 }
 
-glm::vec3 checkCollisions()
-{
-    glm::vec3 hitPoint = glm::vec3(0);
-    
-    // GET COLLISIONS POINTS
-    bulletSimulation.dynamicsWorld->debugDrawWorld();
-    ///one way to draw all the contact points is iterating over contact manifolds in the dispatcher:
-
-    int numManifolds = bulletSimulation.dynamicsWorld->getDispatcher()->getNumManifolds();
-
-    double distance;
-    
-    for (int i=0;i<numManifolds;i++)
-    {
-        btPersistentManifold* contactManifold = bulletSimulation.dynamicsWorld->getDispatcher()->getManifoldByIndexInternal(i);
-//            btCollisionObject* obA = static_cast<btCollisionObject*>(contactManifold->getBody0());
-//            btCollisionObject* obB = static_cast<btCollisionObject*>(contactManifold->getBody1());
-    
-        int numContacts = contactManifold->getNumContacts();
-        
-        for (int j=0;j<numContacts;j++)
-        {
-            btManifoldPoint& pt = contactManifold->getContactPoint(j);
-            if (pt.getPositionWorldOnA().y() > -0.8f)
-            {
-//                    printf("DISTANCE: %lf\n", pt.getDistance());
-//                    
-                btVector3 ptA = pt.getPositionWorldOnA();
-                btVector3 ptB = pt.getPositionWorldOnB();
-//
-//                    printf("WORLD POINT A: %lf %lf %lf\n", ptA.x(),ptA.y(),ptA.z());
-//                    printf("WORLD POINT B: %lf %lf %lf\n", ptB.x(),ptB.y(),ptB.z());
-                
-                contactPoint1 = glm::vec3(ptA.x(), ptA.y(), ptA.z());
-                contactPoint2 = glm::vec3(ptA.x(), ptA.y(), ptA.z());
-                distance = pt.getDistance();
-            }
-        }
-
-        //you can un-comment out this line, and then all points are removed
-        contactManifold->clearManifold();	
-    }
-    
-    if (index_vtd + 1 < 599 && (contactPoint1.x != 0.0f && contactPoint1.y != 0.0f && contactPoint1.z != 0.0f))
-    {
-        if (index_vtd == 0 || (index_vtd > 0 && verticesToDeform[index_vtd-1].x != contactPoint1.x
-                                             && verticesToDeform[index_vtd-1].y != contactPoint1.y 
-                                             && verticesToDeform[index_vtd-1].z != contactPoint1.z))
-        {
-            hittingDirections[index_vtd] = glm::vec3(camera.Front.x, camera.Front.y, camera.Front.z);
-            verticesToDeform[index_vtd++] = glm::vec3(contactPoint1.x, contactPoint1.y, contactPoint1.z);
-//                        printf("VERTICE MESH WORLD: %lf %lf %lf\n", contactPoint1.x, contactPoint1.y, contactPoint1.z);
-//                        printf("%d\n", index_vtd);
-            hitPoint = contactPoint1;
-            hit = true;
-        }
-    }
-    else if (index_vtd + 1 >= 599 && (contactPoint1.x != 0.0f && contactPoint1.y != 0.0f && contactPoint1.z != 0.0f))
-    {
-        index_vtd = 0;
-    }
-    
-    return hitPoint;
-}
-
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
-unsigned int loadTexture(char const * imagePath)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(imagePath, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << imagePath << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
-}
-
-
 void RenderText(Shader &shader, std::string text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
 {
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -1191,54 +1121,86 @@ void RenderText(Shader &shader, std::string text, GLfloat x, GLfloat y, GLfloat
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-int getHitModel(glm::vec3 hitPoint, glm::vec3* cubes_pos, glm::vec3* cubes_size)
+void loadGlyphs(AssetLoader& loader, const string& font, int pixelSize)
 {
-    int hitModel = 0;
-    
-    for (int i = 0; i<total_cubes; i++)
+    vector<GlyphBitmap>* glyphs = new vector<GlyphBitmap>();
+    loader.Add([font, pixelSize, glyphs]()
     {
-//        printf("HITPOINT: %f %f %f\n", hitPoint.x, hitPoint.y, hitPoint.z);
-//        printf("CUBEPOS: %f %f %f\n", cubes_pos[i].x, cubes_pos[i].y, cubes_pos[i].z);
-        float threshold = (cubes_size[i].x + cubes_size[i].y + cubes_size[i].z)/3;
-        if (getDistance(hitPoint, cubes_pos[i]) < threshold + 5)
+        // each worker which uses FreeType needs its own library instance
+        FT_Library ft;
+        if (FT_Init_FreeType(&ft))
         {
-//            printf("HIT MODEL: %d\n", i);
-            hitModel = i;
+            std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
+            return;
         }
-    }
-    
-    return hitModel;
-}
 
+        FT_Face face;
+        if (FT_New_Face(ft, font.c_str(), 0, &face))
+        {
+            std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+            FT_Done_FreeType(ft);
+            return;
+        }
 
-unsigned int loadCubemap(vector<std::string> faces)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        FT_Set_Pixel_Sizes(face, 0, pixelSize);
 
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        for (GLubyte c = 0; c < 128; c++)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 
-                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-            );
-            stbi_image_free(data);
+            // Load character glyph 
+            if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+            {
+                std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
+                continue;
+            }
+            // the bitmap is copied, because it is overwritten by the next glyph
+            GlyphBitmap glyph;
+            glyph.Code = c;
+            const FT_Bitmap& bitmap = face->glyph->bitmap;
+            for (GLuint row = 0; row < bitmap.rows; row++)
+                glyph.Pixels.insert(glyph.Pixels.end(), bitmap.buffer + row * bitmap.pitch, bitmap.buffer + row * bitmap.pitch + bitmap.width);
+            Character character = {
+                0, 
+                glm::ivec2(bitmap.width, bitmap.rows),
+                glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
+                (GLuint)face->glyph->advance.x
+            };
+            glyph.Metrics = character;
+            glyphs->push_back(glyph);
         }
-        else
+
+        FT_Done_Face(face);
+        FT_Done_FreeType(ft);
+    },
+    [glyphs]()
+    {
+        for (GLuint i = 0; i < glyphs->size(); i++)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            GlyphBitmap& glyph = (*glyphs)[i];
+            // Generate texture
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(
+                GL_TEXTURE_2D,
+                0,
+                GL_RED,
+                glyph.Metrics.Size.x,
+                glyph.Metrics.Size.y,
+                0,
+                GL_RED,
+                GL_UNSIGNED_BYTE,
+                glyph.Pixels.empty() ? NULL : &glyph.Pixels[0]
+            );
+            // Set texture options
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            // Now store character for later use
+            glyph.Metrics.TextureID = texture;
+            Characters.insert(std::pair<GLchar, Character>(glyph.Code, glyph.Metrics));
         }
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
-}
\ No newline at end of file
+        glBindTexture(GL_TEXTURE_2D, 0);
+        delete glyphs;
+    });
+}
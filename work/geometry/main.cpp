@@ -10,6 +10,8 @@
 #include <utils/camera.h>
 #include <utils/model_v2.h>
 #include <utils/physics.h>
+#include <utils/impact_queue.h>
+#include <utils/impact_buffer.h>
 
 #include <bullet/btBulletDynamicsCommon.h>
 
@@ -91,10 +93,14 @@ GLfloat planeMaterial[] = {0.0,0.5,0.0};
 // color of the bullets
 GLfloat shootColor[] = {1.0,1.0,0.0};
 
-glm::vec3 verticesToDeform[600];
-glm::vec3 hittingDirections[600];
 int sphereDirCooldown = 0;
-int index_vtd = 0;
+
+// new contacts of the simulation, and impacts on each deformable object (one buffer texture for each object, with no maximum number of impacts)
+ImpactQueue impacts;
+ImpactEvent impactEvents[64];
+vector<ImpactBuffer> impactBuffers;
+// texture unit used for the impacts buffer (the first units are used by the textures of the meshes, and unit 1 by texture1)
+const GLuint IMPACTS_UNIT = 8;
 
 // Lighting
 glm::vec3 pointLightPositions[] = {
@@ -309,17 +315,6 @@ int main()
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     
-    // Initialize verticesToDeform
-    for (int i = 0; i<100; i++)
-    {
-        verticesToDeform[i] = glm::vec3(0.0f);
-    }
-    
-//    for (int i = 0; i<100; i++)
-//    {
-//        printf("%lf, %lf, %lf", verticesToDeform[i].x, verticesToDeform[i].y, verticesToDeform[i].z);
-//    }
-    
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
@@ -364,6 +359,7 @@ int main()
     GLint num_side = 4;
     // total number of the cubes
     GLint total_cubes = num_side*num_side;
+    impactBuffers.resize(total_cubes);
     GLint i,j;
     
     glm::vec3 cube_pos;
@@ -528,35 +524,22 @@ int main()
         
         // GET COLLISIONS POINTS
         bulletSimulation.dynamicsWorld->debugDrawWorld();
-        ///one way to draw all the contact points is iterating over contact manifolds in the dispatcher:
-
-        int numManifolds = bulletSimulation.dynamicsWorld->getDispatcher()->getNumManifolds();
-        
-        glm::vec3 contactPoint1, contactPoint2;
-        double distance;
-        
-        for (i=0;i<numManifolds;i++)
+        // the new contacts are added to the impacts buffer of the deformable object involved (the deformable objects are the first total_cubes collision objects)
+        impacts.Capture(bulletSimulation.dynamicsWorld, currentTime);
+        GLuint numEvents;
+        while ((numEvents = impacts.Pop(impactEvents, 64)) > 0)
         {
-            btPersistentManifold* contactManifold = bulletSimulation.dynamicsWorld->getDispatcher()->getManifoldByIndexInternal(i);
-        
-            int numContacts = contactManifold->getNumContacts();
-            
-            for (int j=0;j<numContacts;j++)
+            for (GLuint e = 0; e < numEvents; e++)
             {
-                btManifoldPoint& pt = contactManifold->getContactPoint(j);
-                if (pt.getPositionWorldOnA().y() > -0.8f)
-                {                 
-                    btVector3 ptA = pt.getPositionWorldOnA();
-                    btVector3 ptB = pt.getPositionWorldOnB();
-                    
-                    contactPoint1 = glm::vec3(ptA.x(), ptA.y(), ptA.z());
-                    contactPoint2 = glm::vec3(ptA.x(), ptA.y(), ptA.z());
-                    distance = pt.getDistance();
-                }
+                if (impactEvents[e].Point.y <= -0.8f)
+                    continue;
+                int hitIndex = impactEvents[e].BodyA->getWorldArrayIndex();
+                if (hitIndex >= total_cubes)
+                    hitIndex = impactEvents[e].BodyB->getWorldArrayIndex();
+                if (hitIndex >= total_cubes)
+                    continue;
+                impactBuffers[hitIndex].Add(impactEvents[e].Point, camera.Front);
             }
-
-            //you can un-comment out this line, and then all points are removed
-            contactManifold->clearManifold();	
         }
         
         ///// Render the deformable objects
@@ -631,6 +614,8 @@ int main()
                         glActiveTexture(GL_TEXTURE1);
                         glBindTexture(GL_TEXTURE_2D, floorTexture);
                         deformShader.setInt("texture1", 1);
+                        // the planes are not deformed
+                        deformShader.setInt("numImpacts", 0);
 
                         // we render the plane
                         cubeModel.Draw(deformShader);
@@ -671,26 +656,11 @@ int main()
             
             glUniformMatrix4fv(glGetUniformLocation(objectShader->ID, "model"), 1, GL_FALSE, glm::value_ptr(objModelMatrix));
         
-            if (index_vtd + 1 < 599 && (contactPoint1.x != 0.0f && contactPoint1.y != 0.0f && contactPoint1.z != 0.0f))
-            {
-                if (index_vtd == 0 || (index_vtd > 0 && verticesToDeform[index_vtd-1].x != contactPoint1.x
-                                                     && verticesToDeform[index_vtd-1].y != contactPoint1.y 
-                                                     && verticesToDeform[index_vtd-1].z != contactPoint1.z))
-                {
-                    hittingDirections[index_vtd] = glm::vec3(camera.Front.x, camera.Front.y, camera.Front.z);
-                    verticesToDeform[index_vtd++] = glm::vec3(contactPoint1.x, contactPoint1.y, contactPoint1.z);
-                }
-            }
-            else if (index_vtd + 1 >= 599 && (contactPoint1.x != 0.0f && contactPoint1.y != 0.0f && contactPoint1.z != 0.0f))
-            {
-                index_vtd = 0;
-            }
-            
             // renderizza il modello
             if (objectShader == &deformShader)
             {
-                glUniform3fv(glGetUniformLocation(objectShader->ID, "impactPoints"), 600, glm::value_ptr(verticesToDeform[0]));
-                glUniform3fv(glGetUniformLocation(objectShader->ID, "hittingDirections"), 600, glm::value_ptr(hittingDirections[0]));
+                // only the impacts on this object are passed to the shader
+                impactBuffers[i].Bind(objectShader->ID, IMPACTS_UNIT, "impacts", "numImpacts");
                 glUniform3fv(objDiffuseLocation, 1, diffuseColor);
                 
                 objectShader->setVec3("viewPos", camera.Position);
@@ -820,6 +790,9 @@ int main()
 //        glfwPollEvents();
     }
 
+    for (i = 0; i < (GLint)impactBuffers.size(); i++)
+        impactBuffers[i].Delete();
+
     glfwTerminate();
     return 0;
 }